@@ -32,6 +32,14 @@ void identifier::accept(visitor &v) const {
 	v.visit(*this);
 }
 
+void integer::accept(visitor &v) const {
+	v.visit(*this);
+}
+
+void bytes::accept(visitor &v) const {
+	v.visit(*this);
+}
+
 void apply::accept(visitor &v) const {
 	v.visit(*this);
 }
@@ -72,7 +80,15 @@ void typealias::accept(visitor &v) const {
 	v.visit(*this);
 }
 
+void macro::accept(visitor &v) const {
+	v.visit(*this);
+}
+
 void binop::accept(visitor &v) const {
 	v.visit(*this);
 }
 
+
+void conditional::accept(visitor &v) const {
+	v.visit(*this);
+}
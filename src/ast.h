@@ -8,19 +8,48 @@
 #define AST_H
 
 #include "location.h"
-#include <memory>
+#include "syntax.h"
+#include <cstddef>
+#include <stdint.h>
 #include <string>
+#include <utility>
 
 namespace ast {
 
 struct visitor;
-struct node;
-typedef std::unique_ptr<node> unique_ptr;
 
+// Nodes are not changed once they are part of a tree, so a subtree may have
+// several parents; each node counts the references which own it.
 struct node {
 	node(location o): origin(o) {}
+	virtual ~node() {}
 	virtual void accept(visitor&) const = 0;
 	location origin;
+	size_t hash = 0; // structural, if computed by a builder
+private:
+	friend class ptr;
+	unsigned owners = 0;
+};
+
+class ptr {
+public:
+	ptr() {}
+	ptr(std::nullptr_t) {}
+	explicit ptr(node *n): p(n) { if (p) ++p->owners; }
+	ptr(const ptr &o): p(o.p) { if (p) ++p->owners; }
+	ptr(ptr &&o): p(o.p) { o.p = nullptr; }
+	~ptr() { if (p && !--p->owners) delete p; }
+	ptr &operator=(ptr o) {
+		std::swap(p, o.p);
+		return *this;
+	}
+	void reset(node *n = nullptr) { *this = ptr(n); }
+	node *get() const { return p; }
+	node *operator->() const { return p; }
+	node &operator*() const { return *p; }
+	explicit operator bool() const { return p != nullptr; }
+private:
+	node *p = nullptr;
 };
 
 struct eof: public node {
@@ -58,11 +87,24 @@ struct identifier: public leaf {
 	virtual void accept(visitor&) const override;
 };
 
+// Literals decoded by the fold pass; the lexer never produces these.
+struct integer: public node {
+	integer(int64_t v, location o): node(o), value(v) {}
+	virtual void accept(visitor&) const override;
+	int64_t value;
+};
+
+struct bytes: public node {
+	bytes(const std::string *v, location o): node(o), value(v) {}
+	virtual void accept(visitor&) const override;
+	const std::string *value; // owned by a constants pool
+};
+
 struct branch: public node {
-	branch(unique_ptr &&l, unique_ptr &&r, location o):
+	branch(ptr &&l, ptr &&r, location o):
 			node(o), left(std::move(l)), right(std::move(r)) {}
-	unique_ptr left;
-	unique_ptr right;
+	ptr left;
+	ptr right;
 };
 
 struct apply: public branch {
@@ -115,13 +157,33 @@ struct typealias: public branch {
 	virtual void accept(visitor&) const override;
 };
 
+// Rewrite rule 'name(pattern) => template', consumed by the expander.
+struct macro: public branch {
+	using branch::branch;
+	virtual void accept(visitor&) const override;
+};
+
 struct binop: public branch {
-	binop(std::string t, unique_ptr &&l, unique_ptr &&r, location o):
-			branch(std::move(l), std::move(r), o), text(t) {}
+	binop(syntax::branch i, std::string t,
+			ptr &&l, ptr &&r, location o):
+			branch(std::move(l), std::move(r), o), id(i), text(t) {}
 	virtual void accept(visitor&) const override;
+	syntax::branch id;
 	std::string text;
 };
 
+// Two-way choice produced by specializing a selector application; the parser
+// has no syntax for it. Only the chosen alternative is evaluated.
+struct conditional: public node {
+	conditional(ptr &&t, ptr &&c, ptr &&a, location o):
+			node(o), test(std::move(t)),
+			consequent(std::move(c)), alternative(std::move(a)) {}
+	virtual void accept(visitor&) const override;
+	ptr test;
+	ptr consequent;
+	ptr alternative;
+};
+
 struct visitor {
 	virtual void visit(const eof&) = 0;
 	virtual void visit(const wildcard&) = 0;
@@ -129,6 +191,8 @@ struct visitor {
 	virtual void visit(const number&) = 0;
 	virtual void visit(const string&) = 0;
 	virtual void visit(const identifier&) = 0;
+	virtual void visit(const integer&) = 0;
+	virtual void visit(const bytes&) = 0;
 	virtual void visit(const apply&) = 0;
 	virtual void visit(const pipe&) = 0;
 	virtual void visit(const sequence&) = 0;
@@ -139,11 +203,13 @@ struct visitor {
 	virtual void visit(const declare&) = 0;
 	virtual void visit(const define&) = 0;
 	virtual void visit(const typealias&) = 0;
+	virtual void visit(const macro&) = 0;
 	virtual void visit(const binop&) = 0;
+	virtual void visit(const conditional&) = 0;
 };
 
 struct delegate {
-	virtual void process(unique_ptr&&) = 0;
+	virtual void process(ptr&&) = 0;
 };
 
 } // namespace ast
@@ -0,0 +1,89 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "builder.h"
+#include "forms.h"
+#include <typeinfo>
+
+using namespace ast;
+
+namespace {
+
+// Do two nodes have the same kind and contents, not counting children?
+bool alike(const node &a, const node &b) {
+	if (typeid(a) != typeid(b)) return false;
+	if (auto l = dynamic_cast<const leaf*>(&a)) {
+		return l->text == static_cast<const leaf&>(b).text;
+	}
+	if (auto i = dynamic_cast<const integer*>(&a)) {
+		return i->value == static_cast<const integer&>(b).value;
+	}
+	if (auto s = dynamic_cast<const bytes*>(&a)) {
+		return s->value == static_cast<const bytes&>(b).value;
+	}
+	if (auto o = dynamic_cast<const binop*>(&a)) {
+		return o->id == static_cast<const binop&>(b).id;
+	}
+	return true;
+}
+
+} // namespace
+
+ptr builder::operator()(node *n) {
+	ptr out(n);
+	n->hash = hash(*n);
+	std::vector<const node*> subs;
+	forms::children(*n, subs);
+	auto range = table.equal_range(n->hash);
+	for (auto i = range.first; i != range.second; ++i) {
+		const node &prior = *i->second;
+		if (!alike(prior, *n)) continue;
+		std::vector<const node*> others;
+		forms::children(prior, others);
+		if (others == subs) {
+			++shared;
+			return i->second;
+		}
+	}
+	table.emplace(n->hash, out);
+	++built;
+	return out;
+}
+
+size_t ast::hash(const node &n) {
+	if (n.hash) return n.hash;
+	size_t h = typeid(n).hash_code();
+	auto mix = [&h](size_t v) { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+	if (auto l = dynamic_cast<const leaf*>(&n)) {
+		mix(std::hash<std::string>()(l->text));
+	} else if (auto i = dynamic_cast<const integer*>(&n)) {
+		mix(std::hash<int64_t>()(i->value));
+	} else if (auto s = dynamic_cast<const bytes*>(&n)) {
+		mix(std::hash<const void*>()(s->value));
+	} else if (auto o = dynamic_cast<const binop*>(&n)) {
+		mix(o->id);
+	}
+	std::vector<const node*> subs;
+	forms::children(n, subs);
+	for (auto sub: subs) {
+		mix(hash(*sub));
+	}
+	// Zero means a node has no cached hash.
+	return h? h: 1;
+}
+
+bool ast::same(const node &a, const node &b) {
+	if (&a == &b) return true;
+	if (a.hash && b.hash && a.hash != b.hash) return false;
+	if (!alike(a, b)) return false;
+	std::vector<const node*> x, y;
+	forms::children(a, x);
+	forms::children(b, y);
+	for (size_t k = 0; k < x.size(); ++k) {
+		if (!same(*x[k], *y[k])) return false;
+	}
+	return true;
+}
@@ -0,0 +1,39 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include "ast.h"
+#include <stddef.h>
+#include <unordered_map>
+
+namespace ast {
+
+// Hash-consing: each distinct subtree is built once. A node handed to the
+// builder with the same kind, contents, and children as one it built before
+// is discarded in favor of that one, so repeated subexpressions share a
+// single tree. Since the children of a node must also have come from the
+// builder, two candidates compare in constant time, by their cached hashes
+// and then by the identity of their children. A shared node keeps the
+// location of its first occurrence.
+class builder {
+public:
+	ptr operator()(node*);
+	size_t built = 0; // distinct nodes
+	size_t shared = 0; // nodes replaced by one built before
+private:
+	std::unordered_multimap<size_t, ptr> table;
+};
+
+// Structural hash and equality, ignoring locations, which make use of the
+// hashes cached by a builder where there are any.
+size_t hash(const node&);
+bool same(const node&, const node&);
+
+} // namespace ast
+
+#endif //BUILDER_H
@@ -0,0 +1,62 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "bytecode.h"
+
+using namespace bytecode;
+
+const char *bytecode::mnemonic(uint8_t op) {
+#define BYTECODE_NAME(name) #name,
+#define BYTECODE_NAMEI(name) #name "i",
+	static const char *names[op_count] = {
+		"nop", "nil", "integer", "load", "move", "getglobal", "setglobal",
+		"upvalue", "closure", "tuple", "range", "length", "element",
+		"buffer", "store", "vector", "neg", "inv",
+		BYTECODE_ARITHMETIC(BYTECODE_NAME)
+		BYTECODE_IMMEDIATE(BYTECODE_NAMEI)
+		"jump", "jumpif", "jumpnot", "jumptable", "call", "apply", "ret",
+		"fail"
+	};
+#undef BYTECODE_NAME
+#undef BYTECODE_NAMEI
+	return op < op_count? names[op]: "?";
+}
+
+void bytecode::disassemble(const program &p, std::ostream &out) {
+	for (size_t i = 0; i < p.constants.size(); ++i) {
+		out << "k" << i << " = ";
+		if (p.constants[i].bytes) {
+			out << "\"" << *p.constants[i].bytes << "\"" << std::endl;
+		} else {
+			out << p.constants[i].integer << std::endl;
+		}
+	}
+	for (size_t i = 0; i < p.globals.size(); ++i) {
+		out << "g" << i << " = " << p.globals[i].name << std::endl;
+	}
+	for (size_t f = 0; f < p.functions.size(); ++f) {
+		const function &fn = p.functions[f];
+		out << "f" << f << " " << fn.name << " (params " << fn.params;
+		out << ", registers " << fn.registers;
+		out << ", captures " << fn.captures << ")" << std::endl;
+		for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+			const instr &i = fn.code[pc];
+			out << "\t" << pc << "\t" << mnemonic(i.op) << "\t" << i.a;
+			out << ", " << i.b << ", " << int16_t(i.c);
+			if (i.n) out << " #" << unsigned(i.n);
+			if (pc < fn.local.size() && fn.local[pc]) out << " local";
+			out << std::endl;
+		}
+		for (size_t t = 0; t < fn.tables.size(); ++t) {
+			const table &tab = fn.tables[t];
+			out << "\ttable " << t << " from " << tab.low << ":";
+			for (unsigned target: tab.targets) {
+				out << " " << target;
+			}
+			out << ", else " << tab.otherwise << std::endl;
+		}
+	}
+}
@@ -0,0 +1,124 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include "location.h"
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace bytecode {
+
+// Register machine instruction set. Each function has a fixed number of
+// registers; parameters arrive in the lowest ones. Operand 'n' is a count,
+// 'a' is usually the destination, and 'b'/'c' are sources. Instructions with
+// an 'i' suffix take a signed 16-bit immediate in 'c' instead of a register.
+#define BYTECODE_ARITHMETIC(X) \
+	X(add) X(sub) X(mul) X(div) X(rem) X(shl) X(shr) \
+	X(band) X(bor) X(bxor) X(bnand) X(bnor) X(bxnor) \
+	X(eq) X(gt) X(lt) X(neq) X(ngt) X(nlt)
+
+#define BYTECODE_IMMEDIATE(X) \
+	X(add) X(sub) X(mul) X(div) X(rem) X(shl) X(shr) X(band) \
+	X(eq) X(gt) X(lt) X(neq) X(ngt) X(nlt)
+
+#define BYTECODE_OP(name) name,
+#define BYTECODE_OPI(name) name##i,
+enum op: uint8_t {
+	nop,
+	nil, // a <- nil
+	integer, // a <- c, sign-extended
+	load, // a <- constants[b]
+	move, // a <- b
+	getglobal, // a <- globals[b], initializing it if necessary
+	setglobal, // globals[b] <- a
+	upvalue, // a <- the current closure's captured value b
+	closure, // a <- functions[b] closed over registers c .. c+n
+	tuple, // a <- array of registers b .. b+n
+	range, // a <- array of integers b .. c, exclusive of c
+	length, // a <- number of elements in sequence b
+	element, // a <- element c of sequence b, which must be in range
+	buffer, // a <- sequence of length b, shaped for the elements of c
+	store, // element b of buffer a <- c, widening a if c is not a byte
+	vector, // the loop which follows maps b into a; c counts elements done
+	neg, // a <- -b
+	inv, // a <- ~b
+	BYTECODE_ARITHMETIC(BYTECODE_OP)
+	BYTECODE_IMMEDIATE(BYTECODE_OPI)
+	jump, // continue at b; a is nonzero where a tail call loops back
+	jumpif, // if a is nonzero, continue at b
+	jumpnot, // if a is zero, continue at b
+	jumptable, // continue at the entry of tables[b] for a, else its default
+	call, // a <- functions[b] applied to registers c .. c+n
+	apply, // a <- value b applied to registers c .. c+n
+	ret, // return a
+	fail, // fault: no clause of functions[b] matches the arguments
+	op_count
+};
+#undef BYTECODE_OP
+#undef BYTECODE_OPI
+
+struct instr {
+	uint8_t op;
+	uint8_t n;
+	uint16_t a;
+	uint16_t b;
+	uint16_t c;
+};
+
+// Targets of a 'jumptable' for the integers low, low + 1, and so on; any
+// other value, or one which is not an integer, goes to the default.
+struct table {
+	int64_t low = 0;
+	std::vector<unsigned> targets;
+	unsigned otherwise = 0;
+};
+
+struct function {
+	std::string name;
+	location origin;
+	unsigned params = 0;
+	unsigned registers = 0;
+	unsigned captures = 0;
+	std::vector<instr> code;
+	std::vector<location> origins; // source of each instruction
+	std::vector<table> tables;
+	// Allocations which never outlive the call, as found by escape analysis;
+	// these go in a region released when the call returns.
+	std::vector<bool> local;
+	bool regional = false; // whether there are any
+};
+
+struct constant {
+	int64_t integer = 0;
+	const std::string *bytes = nullptr; // integer if null
+};
+
+// Function definitions occupy their global slot from the start; value
+// definitions are evaluated by their initializer when first referenced.
+struct global {
+	std::string name;
+	int function = -1; // initially a closure of this function, if any
+	int init = -1; // else computed by applying this function to nothing
+};
+
+struct program {
+	std::vector<function> functions;
+	std::vector<constant> constants;
+	std::vector<global> globals;
+	unsigned init = 0; // runs the top-level statements
+	int main = -1; // global applied to the input stream, if any
+};
+
+const char *mnemonic(uint8_t op);
+void disassemble(const program&, std::ostream&);
+
+} // namespace bytecode
+
+#endif //BYTECODE_H
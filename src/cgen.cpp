@@ -0,0 +1,732 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "cgen.h"
+#include <set>
+#include <sstream>
+
+using namespace bytecode;
+
+// Types and memory management, needed before the program's own tables.
+static const char *prologue = R"(#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { RFL_NIL, RFL_INT, RFL_BLOB, RFL_ARRAY, RFL_CLOSURE };
+typedef struct rfl_value {
+	int type;
+	union {
+		int64_t i;
+		struct rfl_blob *b;
+		struct rfl_array *a;
+		struct rfl_closure *c;
+	} u;
+} rfl_value;
+typedef struct rfl_blob { size_t length; uint8_t *data; } rfl_blob;
+typedef struct rfl_array { size_t length; rfl_value *items; } rfl_array;
+typedef struct rfl_closure {
+	unsigned function;
+	unsigned count;
+	rfl_value *env;
+} rfl_closure;
+typedef rfl_value (*rfl_code)(const rfl_closure*, const rfl_value*);
+
+#ifndef RFL_ALLOC
+#define RFL_ALLOC rfl_default_alloc
+static void *rfl_default_alloc(size_t size) {
+	static char *next, *limit;
+	const size_t chunk = (size_t)1 << 20;
+	size = (size + 15) & ~(size_t)15;
+	if (size > (size_t)(limit - next)) {
+		size_t grab = size > chunk / 4? size: chunk;
+		char *p = malloc(grab);
+		if (!p) {
+			fputs("out of memory\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+		if (grab != chunk) return p;
+		next = p;
+		limit = p + chunk;
+	}
+	next += size;
+	return next - size;
+}
+#endif
+#define rfl_alloc(size) RFL_ALLOC(size)
+
+#ifndef RFL_FAULT
+#define RFL_FAULT rfl_default_fault
+static void rfl_default_fault(const char *msg, int row, int col) {
+	fprintf(stderr, "%d:%d: runtime error: %s\n", row, col, msg);
+	exit(EXIT_FAILURE);
+}
+#endif
+
+static inline rfl_value rfl_nil(void) {
+	rfl_value v;
+	v.type = RFL_NIL;
+	v.u.i = 0;
+	return v;
+}
+static inline rfl_value rfl_int(int64_t i) {
+	rfl_value v;
+	v.type = RFL_INT;
+	v.u.i = i;
+	return v;
+}
+static inline rfl_value rfl_blob_value(rfl_blob *b) {
+	rfl_value v;
+	v.type = RFL_BLOB;
+	v.u.b = b;
+	return v;
+}
+static inline rfl_value rfl_array_value(rfl_array *a) {
+	rfl_value v;
+	v.type = RFL_ARRAY;
+	v.u.a = a;
+	return v;
+}
+static inline rfl_value rfl_closure_value(rfl_closure *c) {
+	rfl_value v;
+	v.type = RFL_CLOSURE;
+	v.u.c = c;
+	return v;
+}
+static inline rfl_blob *rfl_new_blob(size_t length) {
+	rfl_blob *b = rfl_alloc(sizeof(rfl_blob) + length);
+	b->length = length;
+	b->data = (uint8_t*)(b + 1);
+	return b;
+}
+static inline rfl_array *rfl_new_array(size_t length) {
+	rfl_array *a = rfl_alloc(sizeof(rfl_array) + length * sizeof(rfl_value));
+	a->length = length;
+	a->items = (rfl_value*)(a + 1);
+	return a;
+}
+static inline rfl_closure *rfl_new_closure(unsigned function, unsigned n) {
+	rfl_closure *c = rfl_alloc(sizeof(rfl_closure) + n * sizeof(rfl_value));
+	c->function = function;
+	c->count = n;
+	c->env = (rfl_value*)(c + 1);
+	return c;
+}
+static inline int64_t rfl_as_int(rfl_value v, int row, int col) {
+	if (v.type != RFL_INT) RFL_FAULT("operand must be an integer", row, col);
+	return v.u.i;
+}
+static inline int64_t rfl_div(int64_t a, int64_t b, int row, int col) {
+	if (!b) RFL_FAULT("division by zero", row, col);
+	return b == -1? (int64_t)(0 - (uint64_t)a): a / b;
+}
+static inline int64_t rfl_rem(int64_t a, int64_t b, int row, int col) {
+	if (!b) RFL_FAULT("division by zero", row, col);
+	return b == -1? 0: a % b;
+}
+)";
+
+// Runtime operations which depend on the program's function tables.
+static const char *helpers = R"(
+static inline rfl_value rfl_apply(
+		rfl_value fn, const rfl_value *args, unsigned n, int row, int col) {
+	switch (fn.type) {
+		case RFL_CLOSURE:
+			if (rfl_arity[fn.u.c->function] != n) {
+				RFL_FAULT("wrong number of arguments", row, col);
+			}
+			return rfl_functions[fn.u.c->function](fn.u.c, args);
+		case RFL_BLOB:
+			if (n != 1 || args[0].type != RFL_INT) {
+				RFL_FAULT("byte array index must be one integer", row, col);
+			}
+			if ((uint64_t)args[0].u.i >= fn.u.b->length) {
+				RFL_FAULT("index out of range", row, col);
+			}
+			return rfl_int(fn.u.b->data[args[0].u.i]);
+		case RFL_ARRAY:
+			if (n != 1 || args[0].type != RFL_INT) {
+				RFL_FAULT("array index must be one integer", row, col);
+			}
+			if ((uint64_t)args[0].u.i >= fn.u.a->length) {
+				RFL_FAULT("index out of range", row, col);
+			}
+			return fn.u.a->items[args[0].u.i];
+		case RFL_INT:
+			if (n != 2) {
+				RFL_FAULT("a boolean selects between two alternatives",
+						row, col);
+			}
+			return args[fn.u.i? 0: 1];
+		default:
+			RFL_FAULT("value cannot be applied", row, col);
+			return rfl_nil();
+	}
+}
+
+static rfl_value rfl_map(rfl_value seq, rfl_value fn, int row, int col) {
+	size_t i, j, length;
+	rfl_blob *bytes = NULL;
+	rfl_array *items = NULL;
+	if (seq.type == RFL_BLOB) {
+		length = seq.u.b->length;
+		bytes = rfl_new_blob(length);
+	} else if (seq.type == RFL_ARRAY) {
+		length = seq.u.a->length;
+		items = rfl_new_array(length);
+	} else {
+		RFL_FAULT("only sequences can be mapped", row, col);
+		return rfl_nil();
+	}
+	for (i = 0; i < length; ++i) {
+		rfl_value arg = seq.type == RFL_BLOB?
+				rfl_int(seq.u.b->data[i]): seq.u.a->items[i];
+		rfl_value out = rfl_apply(fn, &arg, 1, row, col);
+		if (bytes && out.type == RFL_INT && out.u.i >= 0 && out.u.i < 256) {
+			bytes->data[i] = (uint8_t)out.u.i;
+			continue;
+		}
+		if (bytes) {
+			items = rfl_new_array(length);
+			for (j = 0; j < i; ++j) items->items[j] = rfl_int(bytes->data[j]);
+			bytes = NULL;
+		}
+		items->items[i] = out;
+	}
+	return bytes? rfl_blob_value(bytes): rfl_array_value(items);
+}
+
+static inline rfl_value rfl_mul(rfl_value a, rfl_value b, int row, int col) {
+	if (a.type == RFL_INT && b.type == RFL_INT) {
+		return rfl_int((int64_t)((uint64_t)a.u.i * (uint64_t)b.u.i));
+	}
+	return rfl_map(a, b, row, col);
+}
+
+static inline int64_t rfl_equal(rfl_value a, rfl_value b) {
+	if (a.type != b.type) return 0;
+	switch (a.type) {
+		case RFL_NIL: return -1;
+		case RFL_INT: return -(a.u.i == b.u.i);
+		case RFL_BLOB:
+			return -(a.u.b->length == b.u.b->length &&
+					!memcmp(a.u.b->data, b.u.b->data, a.u.b->length));
+		default: return -(a.u.a == b.u.a);
+	}
+}
+
+static inline int64_t rfl_length(rfl_value seq, int row, int col) {
+	if (seq.type == RFL_BLOB) return (int64_t)seq.u.b->length;
+	if (seq.type == RFL_ARRAY) return (int64_t)seq.u.a->length;
+	RFL_FAULT("only sequences can be mapped", row, col);
+	return 0;
+}
+
+static inline rfl_value rfl_element(rfl_value seq, int64_t i) {
+	return seq.type == RFL_BLOB? rfl_int(seq.u.b->data[i]): seq.u.a->items[i];
+}
+
+static inline rfl_value rfl_buffer(int64_t length, rfl_value shape) {
+	if (length < 0) length = 0;
+	if (shape.type == RFL_BLOB) return rfl_blob_value(rfl_new_blob(length));
+	return rfl_array_value(rfl_new_array(length));
+}
+
+static inline void rfl_store(rfl_value *buf, int64_t i, rfl_value item) {
+	if (buf->type == RFL_BLOB) {
+		rfl_blob *bytes = buf->u.b;
+		int64_t j;
+		if (item.type == RFL_INT && (uint64_t)item.u.i < 256) {
+			bytes->data[i] = (uint8_t)item.u.i;
+			return;
+		}
+		*buf = rfl_array_value(rfl_new_array(bytes->length));
+		for (j = 0; j < i; ++j) buf->u.a->items[j] = rfl_int(bytes->data[j]);
+	}
+	buf->u.a->items[i] = item;
+}
+
+static inline rfl_value rfl_range(int64_t lo, int64_t hi) {
+	size_t i, length = hi > lo? (size_t)((uint64_t)hi - (uint64_t)lo): 0;
+	rfl_array *a = rfl_new_array(length);
+	for (i = 0; i < length; ++i) a->items[i] = rfl_int(lo + (int64_t)i);
+	return rfl_array_value(a);
+}
+
+#ifdef RFL_GLOBALS
+static rfl_value rfl_global(unsigned index, int row, int col) {
+	if (rfl_states[index] == 1) {
+		RFL_FAULT("definition depends on its own value", row, col);
+	}
+	if (rfl_states[index] == 0) {
+		unsigned init = rfl_inits[index];
+		rfl_states[index] = 1;
+		rfl_globals[index] = rfl_functions[init](&rfl_statics[init], NULL);
+		rfl_states[index] = 2;
+	}
+	return rfl_globals[index];
+}
+#endif
+
+#ifndef RFL_NO_MAIN
+static void rfl_write(FILE *out, rfl_value v) {
+	size_t i;
+	switch (v.type) {
+		case RFL_INT: fprintf(out, "%lld", (long long)v.u.i); break;
+		case RFL_BLOB: fwrite(v.u.b->data, 1, v.u.b->length, out); break;
+		case RFL_ARRAY:
+			fputc('(', out);
+			for (i = 0; i < v.u.a->length; ++i) {
+				if (i) fputs(", ", out);
+				rfl_write(out, v.u.a->items[i]);
+			}
+			fputc(')', out);
+			break;
+		case RFL_CLOSURE: fputs("<function>", out); break;
+	}
+}
+#endif
+)";
+
+namespace {
+
+// Flow-insensitive inference of the registers which only ever hold
+// integers. Every register starts out optimistically as an integer and is
+// demoted when any instruction could store something else into it.
+std::vector<bool> integers(const program &p, const function &fn) {
+	std::vector<bool> out(fn.registers, true);
+	std::vector<bool> defined(fn.registers, false);
+	for (unsigned i = 0; i < fn.params && i < fn.registers; ++i) {
+		out[i] = false;
+	}
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto &i: fn.code) {
+			bool result;
+			switch (i.op) {
+				case nil: case getglobal: case upvalue: case closure:
+				case tuple: case range: case bytecode::call: case apply:
+				case element: case buffer: case store:
+					result = false;
+					break;
+				case load: result = !p.constants[i.b].bytes; break;
+				case move: result = out[i.b]; break;
+				case mul: result = out[i.b] && out[i.c]; break;
+				case nop: case vector: case setglobal: case jump:
+				case jumpif: case jumpnot: case jumptable: case ret:
+				case fail:
+					continue;
+				default: result = true; break;
+			}
+			defined[i.a] = true;
+			if (!result && out[i.a]) {
+				out[i.a] = false;
+				changed = true;
+			}
+		}
+	}
+	// A register read before anything is stored in it holds nil.
+	for (unsigned r = fn.params; r < fn.registers; ++r) {
+		if (!defined[r]) out[r] = false;
+	}
+	return out;
+}
+
+std::string literal(int64_t v) {
+	if (v == INT64_MIN) return "(-INT64_C(9223372036854775807) - 1)";
+	return "INT64_C(" + std::to_string(v) + ")";
+}
+
+} // namespace
+
+void cgen::generate(const program &p) {
+	out << "/* generated by rfl -emit-c */" << std::endl;
+	out << prologue << std::endl;
+	size_t nfuncs = p.functions.size();
+	for (size_t f = 0; f < nfuncs; ++f) {
+		out << "static rfl_value rfl_f" << f <<
+				"(const rfl_closure*, const rfl_value*);" << std::endl;
+	}
+	out << "static const rfl_code rfl_functions[] = {";
+	for (size_t f = 0; f < nfuncs; ++f) {
+		out << (f % 8? " ": "\n\t") << "rfl_f" << f << ",";
+	}
+	out << "\n};" << std::endl;
+	out << "static const unsigned rfl_arity[] = {";
+	for (size_t f = 0; f < nfuncs; ++f) {
+		out << (f % 16? " ": "\n\t") << p.functions[f].params << ",";
+	}
+	out << "\n};" << std::endl;
+	out << "static rfl_closure rfl_statics[] = {";
+	for (size_t f = 0; f < nfuncs; ++f) {
+		out << (f % 4? " ": "\n\t") << "{" << f << ", 0, NULL},";
+	}
+	out << "\n};" << std::endl;
+
+	// C arrays may not be empty, so every global table has a spare slot.
+	// Only a program which reads a value definition needs rfl_global and its
+	// tables, and only one which has globals at all needs rfl_globals; unused
+	// statics draw warnings.
+	size_t nglobals = p.globals.size();
+	bool reads = p.main >= 0;
+	bool writes = false;
+	for (auto &f: p.functions) {
+		for (auto &i: f.code) {
+			reads = reads || i.op == getglobal;
+			writes = writes || i.op == setglobal;
+		}
+	}
+	for (auto &g: p.globals) {
+		writes = writes || g.function >= 0;
+	}
+	if (reads || writes) {
+		out << "static rfl_value rfl_globals[" << nglobals + 1 << "];\n";
+	}
+	if (reads) {
+		out << "#define RFL_GLOBALS" << std::endl;
+		out << "static unsigned char rfl_states[] = {";
+		for (auto &g: p.globals) {
+			out << (g.init >= 0? "0, ": "2, ");
+		}
+		out << "2};" << std::endl;
+		out << "static const unsigned rfl_inits[] = {";
+		for (auto &g: p.globals) {
+			out << (g.init >= 0? g.init: 0) << ", ";
+		}
+		out << "0};" << std::endl;
+	}
+
+	for (size_t k = 0; k < p.constants.size(); ++k) {
+		const std::string *bytes = p.constants[k].bytes;
+		if (!bytes) continue;
+		out << "static uint8_t rfl_k" << k << "_data[] = {";
+		for (size_t i = 0; i < bytes->size(); ++i) {
+			out << (i % 16? " ": "\n\t") << unsigned(uint8_t((*bytes)[i]));
+			out << ",";
+		}
+		out << (bytes->empty()? "0": "") << "\n};" << std::endl;
+		out << "static rfl_blob rfl_k" << k << " = {" << bytes->size();
+		out << ", rfl_k" << k << "_data};" << std::endl;
+	}
+	out << helpers << std::endl;
+
+	for (size_t f = 0; f < nfuncs; ++f) {
+		function(p, f);
+	}
+
+	out << "rfl_value rfl_run(rfl_value input) {" << std::endl;
+	for (size_t g = 0; g < nglobals; ++g) {
+		if (p.globals[g].function >= 0) {
+			out << "\trfl_globals[" << g << "] = rfl_closure_value(";
+			out << "&rfl_statics[" << p.globals[g].function << "]);\n";
+		}
+	}
+	out << "\trfl_value result = rfl_f" << p.init << "(";
+	out << "&rfl_statics[" << p.init << "], NULL);" << std::endl;
+	if (p.main >= 0) {
+		out << "\tresult = rfl_apply(rfl_global(" << p.main << ", 0, 0), ";
+		out << "&input, 1, 0, 0);" << std::endl;
+	} else {
+		out << "\t(void)input;" << std::endl;
+	}
+	out << "\treturn result;" << std::endl;
+	out << "}" << std::endl << std::endl;
+
+	out << R"(#ifndef RFL_NO_MAIN
+int main(void) {
+	size_t size = 0, space = 1 << 16;
+	uint8_t *buf = malloc(space);
+	size_t got;
+	rfl_blob input;
+	rfl_value result;
+	while (buf && (got = fread(buf + size, 1, space - size, stdin)) > 0) {
+		size += got;
+		if (size == space) buf = realloc(buf, space *= 2);
+	}
+	if (!buf) {
+		fputs("out of memory\n", stderr);
+		return EXIT_FAILURE;
+	}
+	input.length = size;
+	input.data = buf;
+	result = rfl_run(rfl_blob_value(&input));
+	rfl_write(stdout, result);
+)";
+	if (p.main < 0) {
+		out << "\tif (result.type != RFL_NIL) fputc('\\n', stdout);\n";
+	}
+	out << "\treturn EXIT_SUCCESS;\n}\n#endif" << std::endl;
+}
+
+void cgen::function(const program &p, unsigned index) {
+	const bytecode::function &fn = p.functions[index];
+	std::vector<bool> isint = integers(p, fn);
+	std::set<unsigned> targets;
+	std::set<unsigned> used;
+	for (auto &i: fn.code) {
+		if (i.op == jump || i.op == jumpif || i.op == jumpnot) {
+			targets.insert(i.b);
+		}
+	}
+	for (auto &t: fn.tables) {
+		targets.insert(t.targets.begin(), t.targets.end());
+		targets.insert(t.otherwise);
+	}
+	auto reg = [&](unsigned r) {
+		used.insert(r);
+		return "r" + std::to_string(r);
+	};
+	std::stringstream body;
+	for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+		const instr &i = fn.code[pc];
+		location loc = pc < fn.origins.size()? fn.origins[pc]: fn.origin;
+		std::string where = std::to_string(loc.begin.row()) + ", " +
+				std::to_string(loc.begin.col());
+		auto I = [&](unsigned r) {
+			return isint[r]? reg(r): "rfl_as_int(" + reg(r) + ", " +
+					where + ")";
+		};
+		auto V = [&](unsigned r) {
+			return isint[r]? "rfl_int(" + reg(r) + ")": reg(r);
+		};
+		auto set = [&](std::string expr) {
+			if (isint[i.a]) {
+				body << "\t" << reg(i.a) << " = " << expr << ";\n";
+			} else {
+				body << "\t" << reg(i.a) << " = rfl_int(" << expr << ");\n";
+			}
+		};
+		auto args = [&](unsigned base, unsigned n) {
+			if (!n) return std::string("NULL");
+			std::string list = "(const rfl_value[]){";
+			for (unsigned k = 0; k < n; ++k) {
+				list += (k? ", ": "") + V(base + k);
+			}
+			return list + "}";
+		};
+		// Operands b and c are registers only for the arithmetic ops;
+		// elsewhere they are indexes, jump targets, or immediates.
+		bool arithmetic = i.op == range || i.op == buffer ||
+				i.op == neg || i.op == inv ||
+				(i.op >= add && i.op <= nlti);
+		std::string b = arithmetic? I(i.b): "";
+		std::string c = std::to_string(int16_t(i.c));
+		bool immediate = false;
+		switch (i.op) {
+#define BYTECODE_IMM(name) case name##i:
+			BYTECODE_IMMEDIATE(BYTECODE_IMM)
+#undef BYTECODE_IMM
+				immediate = true;
+				break;
+			default:
+				break;
+		}
+		if (!immediate && i.op >= add && i.op <= nlt) {
+			c = I(i.c);
+		}
+		if (targets.count(pc)) {
+			body << "L" << pc << ":;\n";
+		}
+		switch (i.op) {
+			case nop: break;
+			// The C compiler does its own vectorizing.
+			case vector: break;
+			case nil:
+				body << "\t" << reg(i.a) << " = rfl_nil();\n";
+				break;
+			case integer: set(c); break;
+			case load:
+				if (p.constants[i.b].bytes) {
+					body << "\t" << reg(i.a) << " = rfl_blob_value(&rfl_k";
+					body << i.b << ");\n";
+				} else {
+					set(literal(p.constants[i.b].integer));
+				}
+				break;
+			case move:
+				if (isint[i.a] || !isint[i.b]) {
+					body << "\t" << reg(i.a) << " = " << reg(i.b) << ";\n";
+				} else {
+					body << "\t" << reg(i.a) << " = " << V(i.b) << ";\n";
+				}
+				break;
+			case getglobal:
+				body << "\t" << reg(i.a) << " = rfl_global(" << i.b << ", ";
+				body << where << ");\n";
+				break;
+			case setglobal:
+				body << "\trfl_globals[" << i.b << "] = " << V(i.a) << ";\n";
+				break;
+			case upvalue:
+				body << "\t" << reg(i.a) << " = self->env[" << i.b << "];\n";
+				break;
+			case closure:
+				if (!i.n) {
+					body << "\t" << reg(i.a) << " = rfl_closure_value(";
+					body << "&rfl_statics[" << i.b << "]);\n";
+					break;
+				}
+				body << "\t{\n\t\trfl_closure *c = rfl_new_closure(" << i.b;
+				body << ", " << unsigned(i.n) << ");\n";
+				for (unsigned k = 0; k < i.n; ++k) {
+					body << "\t\tc->env[" << k << "] = " << V(i.c + k);
+					body << ";\n";
+				}
+				body << "\t\t" << reg(i.a) << " = rfl_closure_value(c);\n\t}\n";
+				break;
+			case tuple:
+				body << "\t{\n\t\trfl_array *t = rfl_new_array(";
+				body << unsigned(i.n) << ");\n";
+				for (unsigned k = 0; k < i.n; ++k) {
+					body << "\t\tt->items[" << k << "] = " << V(i.b + k);
+					body << ";\n";
+				}
+				body << "\t\t" << reg(i.a) << " = rfl_array_value(t);\n\t}\n";
+				break;
+			case range:
+				body << "\t" << reg(i.a) << " = rfl_range(" << b << ", ";
+				body << I(i.c) << ");\n";
+				break;
+			case length:
+				set("rfl_length(" + V(i.b) + ", " + where + ")");
+				break;
+			case element:
+				body << "\t" << reg(i.a) << " = rfl_element(" << V(i.b);
+				body << ", " << I(i.c) << ");\n";
+				break;
+			case buffer:
+				body << "\t" << reg(i.a) << " = rfl_buffer(" << b << ", ";
+				body << V(i.c) << ");\n";
+				break;
+			case store:
+				body << "\trfl_store(&" << reg(i.a) << ", " << I(i.b) << ", ";
+				body << V(i.c) << ");\n";
+				break;
+			case neg: set("(int64_t)(0 - (uint64_t)" + b + ")"); break;
+			case inv: set("~" + b); break;
+			case add: case addi:
+				set("(int64_t)((uint64_t)" + b + " + (uint64_t)" + c + ")");
+				break;
+			case sub: case subi:
+				set("(int64_t)((uint64_t)" + b + " - (uint64_t)" + c + ")");
+				break;
+			case mul:
+				if (!isint[i.a]) {
+					body << "\t" << reg(i.a) << " = rfl_mul(" << V(i.b);
+					body << ", " << V(i.c) << ", " << where << ");\n";
+					break;
+				}
+				// fall through
+			case muli:
+				set("(int64_t)((uint64_t)" + b + " * (uint64_t)" + c + ")");
+				break;
+			case bytecode::div: case divi: case rem: case remi: {
+				bool quotient = i.op == bytecode::div || i.op == divi;
+				if (immediate && c != "0" && c != "-1") {
+					set(b + (quotient? " / ": " % ") + c);
+				} else {
+					set(std::string(quotient? "rfl_div(": "rfl_rem(") +
+							b + ", " + c + ", " + where + ")");
+				}
+			} break;
+			case shl: case shli:
+				set("(int64_t)((uint64_t)" + b + " << (" + c + " & 63))");
+				break;
+			case shr: case shri:
+				set("(" + b + " >> (" + c + " & 63))");
+				break;
+			case band: case bandi: set("(" + b + " & " + c + ")"); break;
+			case bor: set("(" + b + " | " + c + ")"); break;
+			case bxor: set("(" + b + " ^ " + c + ")"); break;
+			case bnand: set("~(" + b + " & " + c + ")"); break;
+			case bnor: set("~(" + b + " | " + c + ")"); break;
+			case bxnor: set("~(" + b + " ^ " + c + ")"); break;
+			case eq: case neq:
+				if (!isint[i.b] || !isint[i.c]) {
+					std::string test = "rfl_equal(" + V(i.b) + ", " +
+							V(i.c) + ")";
+					set(i.op == eq? test: "~" + test);
+					break;
+				}
+				// fall through
+			case eqi: case neqi: case gt: case gti: case lt: case lti:
+			case ngt: case ngti: case nlt: case nlti: {
+				const char *rel = "==";
+				switch (i.op) {
+					case neq: case neqi: rel = "!="; break;
+					case gt: case gti: rel = ">"; break;
+					case lt: case lti: rel = "<"; break;
+					case ngt: case ngti: rel = "<="; break;
+					case nlt: case nlti: rel = ">="; break;
+				}
+				set("-(int64_t)(" + b + " " + rel + " " + c + ")");
+			} break;
+			case jump:
+				body << "\tgoto L" << i.b << ";\n";
+				break;
+			case jumpif:
+				body << "\tif (" << I(i.a) << ") goto L" << i.b << ";\n";
+				break;
+			case jumpnot:
+				body << "\tif (!" << I(i.a) << ") goto L" << i.b << ";\n";
+				break;
+			case jumptable: {
+				// The C compiler turns a dense switch into a table of its own.
+				const table &t = fn.tables[i.b];
+				if (isint[i.a]) {
+					body << "\tswitch (" << reg(i.a) << ") {\n";
+				} else {
+					body << "\tif (" << reg(i.a) << ".type == RFL_INT) ";
+					body << "switch (" << reg(i.a) << ".u.i) {\n";
+				}
+				for (size_t k = 0; k < t.targets.size(); ++k) {
+					if (t.targets[k] == t.otherwise) continue;
+					body << "\t\tcase " << literal(t.low + int64_t(k));
+					body << ": goto L" << t.targets[k] << ";\n";
+				}
+				body << "\t}\n\tgoto L" << t.otherwise << ";\n";
+			} break;
+			case bytecode::call:
+				body << "\t" << reg(i.a) << " = rfl_f" << i.b << "(";
+				body << "&rfl_statics[" << i.b << "], " << args(i.c, i.n);
+				body << ");\n";
+				break;
+			case apply:
+				body << "\t" << reg(i.a) << " = rfl_apply(" << V(i.b) << ", ";
+				body << args(i.c, i.n) << ", " << unsigned(i.n) << ", ";
+				body << where << ");\n";
+				break;
+			case ret:
+				body << "\treturn " << V(i.a) << ";\n";
+				break;
+			case fail:
+				body << "\tRFL_FAULT(\"no clause of '";
+				body << p.functions[i.b].name;
+				body << "' matches the arguments\", " << where << ");\n";
+				body << "\treturn rfl_nil();\n";
+				break;
+		}
+	}
+
+	out << "/* " << fn.name << " at " << fn.origin.begin.row() << ":";
+	out << fn.origin.begin.col() << " */" << std::endl;
+	out << "static rfl_value rfl_f" << index << "(";
+	out << "const rfl_closure *self, const rfl_value *args) {" << std::endl;
+	for (unsigned r: used) {
+		if (r < fn.params) {
+			out << "\trfl_value r" << r << " = args[" << r << "];\n";
+		} else if (isint[r]) {
+			out << "\tint64_t r" << r << " = 0;\n";
+		} else {
+			out << "\trfl_value r" << r << " = rfl_nil();\n";
+		}
+	}
+	out << "\t(void)self;\n\t(void)args;\n";
+	out << body.str();
+	out << "}" << std::endl << std::endl;
+}
@@ -0,0 +1,32 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef CGEN_H
+#define CGEN_H
+
+#include "bytecode.h"
+#include <ostream>
+
+// Lowers a compiled program to a self-contained C99 translation unit. Names
+// have already been resolved by the bytecode compiler, so each function
+// becomes a C function whose registers are local variables. Registers which
+// can only ever hold integers are inferred and declared as int64_t, so
+// integer code compiles to plain arithmetic with no tag checks.
+//
+// All memory comes from rfl_alloc(), and errors end in rfl_fault(). Both
+// may be supplied by the embedding environment by defining RFL_ALLOC or
+// RFL_FAULT before the generated code; define RFL_NO_MAIN to link the
+// program into another executable and call rfl_run() directly.
+class cgen {
+public:
+	cgen(std::ostream &o): out(o) {}
+	void generate(const bytecode::program&);
+private:
+	void function(const bytecode::program&, unsigned index);
+	std::ostream &out;
+};
+
+#endif //CGEN_H
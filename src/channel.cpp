@@ -0,0 +1,134 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "channel.h"
+#include <algorithm>
+
+using namespace runtime;
+
+// A side about to block sets its waiting flag and then looks again, while
+// the other side publishes and then checks the flag. The sequentially
+// consistent fences between each pair of steps guarantee that at least one
+// of them sees the other, so no wakeup is lost.
+
+channel::channel(size_t capacity) {
+	size_t size = 1;
+	while (size < capacity) size <<= 1;
+	buffer = new uint8_t[size];
+	mask = size - 1;
+}
+
+channel::~channel() {
+	delete[] buffer;
+}
+
+void channel::attach(process *p, process *c) {
+	producer = p;
+	consumer = c;
+}
+
+size_t channel::space() {
+	size_t at = head.load(std::memory_order_relaxed);
+	size_t capacity = mask + 1;
+	if (at - tail_seen == capacity) {
+		tail_seen = tail.load(std::memory_order_acquire);
+		if (at - tail_seen == capacity) {
+			writer_waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			tail_seen = tail.load(std::memory_order_acquire);
+			if (at - tail_seen == capacity) return 0;
+			writer_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+	return capacity - (at - tail_seen);
+}
+
+size_t channel::writable(uint8_t **data) {
+	size_t bytes = space();
+	size_t offset = head.load(std::memory_order_relaxed) & mask;
+	*data = buffer + offset;
+	return std::min(bytes, mask + 1 - offset);
+}
+
+int channel::writable(iovec spans[2]) {
+	return split(head.load(std::memory_order_relaxed), space(), spans);
+}
+
+int channel::split(size_t at, size_t bytes, iovec spans[2]) {
+	if (!bytes) return 0;
+	size_t offset = at & mask;
+	size_t first = std::min(bytes, mask + 1 - offset);
+	spans[0].iov_base = buffer + offset;
+	spans[0].iov_len = first;
+	if (first == bytes) return 1;
+	spans[1].iov_base = buffer;
+	spans[1].iov_len = bytes - first;
+	return 2;
+}
+
+void channel::commit(size_t bytes) {
+	head.store(head.load(std::memory_order_relaxed) + bytes,
+			std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (reader_waiting.load(std::memory_order_relaxed) &&
+			reader_waiting.exchange(false)) {
+		consumer->wake();
+	}
+}
+
+void channel::close() {
+	closed.store(true, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (reader_waiting.load(std::memory_order_relaxed) &&
+			reader_waiting.exchange(false)) {
+		consumer->wake();
+	}
+}
+
+size_t channel::waiting() {
+	size_t at = tail.load(std::memory_order_relaxed);
+	if (at == head_seen) {
+		head_seen = head.load(std::memory_order_acquire);
+		if (at == head_seen) {
+			reader_waiting.store(true, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			head_seen = head.load(std::memory_order_acquire);
+			if (at == head_seen) return 0;
+			reader_waiting.store(false, std::memory_order_relaxed);
+		}
+	}
+	return head_seen - at;
+}
+
+size_t channel::readable(const uint8_t **data) {
+	size_t bytes = waiting();
+	size_t offset = tail.load(std::memory_order_relaxed) & mask;
+	*data = buffer + offset;
+	return std::min(bytes, mask + 1 - offset);
+}
+
+int channel::readable(iovec spans[2]) {
+	return split(tail.load(std::memory_order_relaxed), waiting(), spans);
+}
+
+void channel::consume(size_t bytes) {
+	size_t at = tail.load(std::memory_order_relaxed) + bytes;
+	tail.store(at, std::memory_order_release);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (!writer_waiting.load(std::memory_order_relaxed)) return;
+	// Waking the producer for every few bytes freed would have it trade
+	// places with the consumer at each step, so wait for half the buffer.
+	size_t used = head.load(std::memory_order_acquire) - at;
+	if (used <= (mask + 1) / 2 && writer_waiting.exchange(false)) {
+		producer->wake();
+	}
+}
+
+bool channel::finished() const {
+	return closed.load(std::memory_order_acquire) &&
+			tail.load(std::memory_order_relaxed) ==
+			head.load(std::memory_order_acquire);
+}
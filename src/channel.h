@@ -0,0 +1,75 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include "scheduler.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+namespace runtime {
+
+// Bounded byte stream from one producer process to one consumer process,
+// using a lock-free ring buffer. Each side works on whole spans of bytes in
+// place and publishes them in one step, so synchronization happens per
+// batch, never per byte. An empty channel blocks the consumer and a full one
+// blocks the producer; each wakes the other only when it was waiting.
+class channel {
+public:
+	explicit channel(size_t capacity = 1 << 16); // rounded up to a power of 2
+	channel(const channel&) = delete;
+	~channel();
+	void attach(process *producer, process *consumer);
+
+	// Producer side. writable() yields the contiguous free space, which is
+	// empty only when the channel is full; the producer should then block,
+	// and will be woken once the consumer has drained half the buffer.
+	size_t writable(uint8_t **data);
+	void commit(size_t bytes);
+	void close();
+
+	// Consumer side. readable() yields the contiguous bytes waiting, which
+	// are none only when the channel is empty; unless it is also finished,
+	// the consumer should then block until the producer commits or closes.
+	size_t readable(const uint8_t **data);
+	void consume(size_t bytes);
+	bool finished() const;
+
+	// As above, but including the part which wraps around to the start of
+	// the buffer, for vectored I/O; these yield the number of spans.
+	int writable(iovec spans[2]);
+	int readable(iovec spans[2]);
+
+private:
+	size_t space();
+	size_t waiting();
+	int split(size_t at, size_t bytes, iovec spans[2]);
+	uint8_t *buffer;
+	size_t mask;
+	process *producer = nullptr;
+	process *consumer = nullptr;
+	// Each index is written by one side only, and the two sides' fields
+	// are kept on separate cache lines. Each side also keeps a stale copy
+	// of the other's index, refreshing it only when it seems to have run
+	// out, so the shared lines rarely move.
+	char spacing[64];
+	std::atomic<size_t> head{0}; // next byte the producer writes
+	size_t tail_seen = 0;
+	std::atomic<bool> writer_waiting{false};
+	std::atomic<bool> closed{false};
+	char producer_spacing[64];
+	std::atomic<size_t> tail{0}; // next byte the consumer reads
+	size_t head_seen = 0;
+	std::atomic<bool> reader_waiting{false};
+	char consumer_spacing[64];
+};
+
+} // namespace runtime
+
+#endif //CHANNEL_H
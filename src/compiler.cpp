@@ -0,0 +1,1086 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "compiler.h"
+#include "escape.h"
+#include "forms.h"
+#include "match.h"
+#include <algorithm>
+#include <map>
+#include <set>
+#include <stdint.h>
+
+using namespace bytecode;
+
+namespace {
+
+// Names visible inside the function currently being generated.
+struct scope {
+	scope *outer = nullptr;
+	unsigned index = 0;
+	std::map<std::string, unsigned> locals;
+	std::vector<std::string> captures;
+	unsigned temps = 0;
+	unsigned high = 0;
+	// Functions whose code begins within this one, at these addresses once
+	// they are known; a call to one in tail position becomes a jump. The
+	// jumps wait here for their targets.
+	std::map<unsigned, unsigned> entries;
+	std::vector<std::pair<unsigned, unsigned>> loops;
+};
+
+// A top-level definition whose code is yet to be generated; a value is
+// computed by a function of no parameters with a single clause.
+struct pending {
+	unsigned index;
+	std::vector<match::clause> clauses;
+};
+
+// A chain of element-wise stages applied to a source sequence, as in
+// 'str * (c -> ...) * f'. Each stage is a literal capture of one parameter
+// or the name of a top-level function of one parameter.
+struct pipeline {
+	const ast::node *source = nullptr;
+	const ast::range *range = nullptr;
+	std::vector<const ast::node*> stages;
+};
+
+class generator: public ast::visitor {
+public:
+	generator(program &p, errors &e, bool r):
+			prog(p), err(e), recursion(r) {}
+	void translate(const ast::node&);
+	virtual void visit(const ast::eof&) override;
+	virtual void visit(const ast::wildcard&) override;
+	virtual void visit(const ast::null&) override;
+	virtual void visit(const ast::number&) override;
+	virtual void visit(const ast::string&) override;
+	virtual void visit(const ast::identifier&) override;
+	virtual void visit(const ast::integer&) override;
+	virtual void visit(const ast::bytes&) override;
+	virtual void visit(const ast::apply&) override;
+	virtual void visit(const ast::pipe&) override;
+	virtual void visit(const ast::sequence&) override;
+	virtual void visit(const ast::pair&) override;
+	virtual void visit(const ast::range&) override;
+	virtual void visit(const ast::assign&) override;
+	virtual void visit(const ast::capture&) override;
+	virtual void visit(const ast::declare&) override;
+	virtual void visit(const ast::define&) override;
+	virtual void visit(const ast::typealias&) override;
+	virtual void visit(const ast::macro&) override;
+	virtual void visit(const ast::binop&) override;
+	virtual void visit(const ast::conditional&) override;
+private:
+	function &fn() { return prog.functions[cur->index]; }
+	unsigned emit(uint8_t op, unsigned a, unsigned b, unsigned c,
+			unsigned n, location);
+	void patch(unsigned at, unsigned target) { fn().code[at].b = target; }
+	unsigned here() { return fn().code.size(); }
+	unsigned temp();
+	void compile(const ast::node&, unsigned dest, bool tail = false);
+	unsigned value(const ast::node&);
+	bool local(const std::string&, unsigned *reg);
+	static bool visible(const scope*, const std::string&);
+	bool resolve(const std::string&, location, unsigned dest);
+	void call(const ast::node &fn, const ast::node &args, location);
+	bool stage(const ast::node&);
+	bool chain(const ast::node&, pipeline*);
+	void fuse(const pipeline&, location);
+	unsigned step(const ast::node &stage, unsigned input);
+	unsigned declare(std::string name, unsigned params, location);
+	void generate(const std::vector<pending>&);
+	void loop(const std::vector<const pending*>&);
+	void select(unsigned index, const std::vector<match::clause>&,
+			scope *outer, std::vector<std::string> *captures);
+	void clauses(unsigned index, const std::vector<match::clause>&);
+	void decide(const match::tree&, const std::vector<match::clause>&,
+			unsigned index, unsigned result);
+	struct labels;
+	void test(const match::decision&, labels&);
+	void alternatives(const std::vector<const ast::capture*>&, location);
+	unsigned pool(int64_t);
+	unsigned pool(const std::string*);
+	program &prog;
+	errors &err;
+	bool recursion;
+	scope *cur = nullptr;
+	unsigned dest = 0;
+	bool tail = false; // the value of the expression is returned as it is
+	int definition = -1; // the top-level function being generated, if any
+	std::map<unsigned, unsigned> component; // of the call graph
+	std::map<std::string, unsigned> globals;
+	std::map<std::string, unsigned> functions;
+	std::map<int64_t, unsigned> integers;
+	std::map<const std::string*, unsigned> strings;
+};
+
+// The function a call applies, if it is given by name.
+const ast::identifier *callee(const ast::node &n) {
+	const ast::node *fn = nullptr;
+	if (auto a = dynamic_cast<const ast::apply*>(&n)) {
+		fn = a->left.get();
+	} else if (auto p = dynamic_cast<const ast::pipe*>(&n)) {
+		fn = p->right.get();
+	}
+	return dynamic_cast<const ast::identifier*>(fn);
+}
+
+// Every name applied by a call anywhere within an expression, including
+// the bodies of captures, which call on the same stack.
+void applied(const ast::node &n, std::vector<std::string> &out) {
+	if (auto name = callee(n)) {
+		out.push_back(name->text);
+	}
+	std::vector<const ast::node*> subs;
+	forms::children(n, subs);
+	for (auto sub: subs) {
+		applied(*sub, out);
+	}
+}
+
+// Tarjan's algorithm: numbers the strongly connected components of a graph
+// given as lists of successors.
+class components {
+public:
+	explicit components(const std::vector<std::vector<size_t>> &e):
+			edges(e), order(e.size(), -1), low(e.size()),
+			stacked(e.size(), false), of(e.size()) {
+		for (size_t v = 0; v < edges.size(); ++v) {
+			if (order[v] < 0) visit(v);
+		}
+	}
+	size_t operator[](size_t v) const { return of[v]; }
+private:
+	void visit(size_t v) {
+		order[v] = low[v] = next++;
+		stack.push_back(v);
+		stacked[v] = true;
+		for (size_t w: edges[v]) {
+			if (order[w] < 0) {
+				visit(w);
+				low[v] = std::min(low[v], low[w]);
+			} else if (stacked[w]) {
+				low[v] = std::min(low[v], order[w]);
+			}
+		}
+		if (low[v] != order[v]) return;
+		size_t w;
+		do {
+			w = stack.back();
+			stack.pop_back();
+			stacked[w] = false;
+			of[w] = count;
+		} while (w != v);
+		++count;
+	}
+	const std::vector<std::vector<size_t>> &edges;
+	std::vector<int> order, low;
+	std::vector<bool> stacked;
+	std::vector<size_t> of, stack;
+	int next = 0;
+	size_t count = 0;
+};
+
+bool immediate(const ast::node &n, int16_t *out) {
+	auto i = dynamic_cast<const ast::integer*>(&n);
+	if (!i || i->value < INT16_MIN || i->value > INT16_MAX) return false;
+	*out = i->value;
+	return true;
+}
+
+} // namespace
+
+unsigned generator::emit(uint8_t op, unsigned a, unsigned b, unsigned c,
+		unsigned n, location loc) {
+	// Immediates arrive already narrowed, so every operand must fit.
+	if (a > UINT16_MAX || b > UINT16_MAX || c > UINT16_MAX ||
+			n > UINT8_MAX) {
+		err.report(loc, "expression is too large to compile");
+	}
+	function &f = fn();
+	f.code.push_back(instr{op, uint8_t(n), uint16_t(a), uint16_t(b),
+			uint16_t(c)});
+	f.origins.push_back(loc);
+	return f.code.size() - 1;
+}
+
+unsigned generator::temp() {
+	unsigned reg = cur->temps++;
+	if (cur->temps > cur->high) {
+		cur->high = cur->temps;
+	}
+	return reg;
+}
+
+void generator::compile(const ast::node &n, unsigned reg, bool last) {
+	// Temporaries are allocated in stack order, so everything an expression
+	// needed is free again once its result is in place.
+	unsigned mark = cur->temps;
+	unsigned saved = dest;
+	bool was = tail;
+	dest = reg;
+	tail = last;
+	n.accept(*this);
+	dest = saved;
+	tail = was;
+	cur->temps = mark;
+}
+
+unsigned generator::value(const ast::node &n) {
+	unsigned reg;
+	auto i = dynamic_cast<const ast::identifier*>(&n);
+	if (i && local(i->text, &reg)) {
+		return reg;
+	}
+	reg = temp();
+	compile(n, reg);
+	return reg;
+}
+
+bool generator::local(const std::string &name, unsigned *reg) {
+	auto found = cur->locals.find(name);
+	if (found == cur->locals.end()) return false;
+	*reg = found->second;
+	return true;
+}
+
+bool generator::visible(const scope *s, const std::string &name) {
+	for (; s; s = s->outer) {
+		if (s->locals.count(name)) return true;
+		for (auto &c: s->captures) {
+			if (c == name) return true;
+		}
+	}
+	return false;
+}
+
+bool generator::resolve(const std::string &name, location loc, unsigned reg) {
+	unsigned slot;
+	if (local(name, &slot)) {
+		if (slot != reg) emit(move, reg, slot, 0, 0, loc);
+		return true;
+	}
+	for (slot = 0; slot < cur->captures.size(); ++slot) {
+		if (cur->captures[slot] == name) break;
+	}
+	if (slot == cur->captures.size()) {
+		// The name must be borrowed from an enclosing function, if any
+		// encloses it; otherwise it can only be a global.
+		if (!visible(cur->outer, name)) {
+			auto g = globals.find(name);
+			if (g == globals.end()) return false;
+			emit(getglobal, reg, g->second, 0, 0, loc);
+			return true;
+		}
+		cur->captures.push_back(name);
+	}
+	emit(upvalue, reg, slot, 0, 0, loc);
+	return true;
+}
+
+unsigned generator::pool(int64_t value) {
+	auto found = integers.find(value);
+	if (found != integers.end()) return found->second;
+	constant k;
+	k.integer = value;
+	prog.constants.push_back(k);
+	return integers[value] = prog.constants.size() - 1;
+}
+
+unsigned generator::pool(const std::string *value) {
+	auto found = strings.find(value);
+	if (found != strings.end()) return found->second;
+	constant k;
+	k.bytes = value;
+	prog.constants.push_back(k);
+	return strings[value] = prog.constants.size() - 1;
+}
+
+unsigned generator::declare(std::string name, unsigned params, location loc) {
+	prog.functions.emplace_back();
+	function &f = prog.functions.back();
+	f.name = name;
+	f.params = params;
+	f.origin = loc;
+	return prog.functions.size() - 1;
+}
+
+// Functions which call each other in tail position, directly or through
+// others, are generated together, so that those calls can be jumps.
+void generator::generate(const std::vector<pending> &list) {
+	std::map<unsigned, size_t> at;
+	for (size_t i = 0; i < list.size(); ++i) {
+		at[list[i].index] = i;
+	}
+	std::vector<std::vector<size_t>> tails(list.size());
+	std::vector<std::vector<size_t>> calls(list.size());
+	for (size_t i = 0; i < list.size(); ++i) {
+		for (auto &c: list[i].clauses) {
+			// A parameter or local may hide a function of the same name.
+			std::vector<std::string> hidden;
+			forms::assigned(*c.body, hidden);
+			for (auto &p: c.patterns) {
+				hidden.push_back(p.name);
+			}
+			auto edge = [&](const std::string &name,
+					std::vector<size_t> &out) {
+				auto f = functions.find(name);
+				if (f == functions.end() || std::count(
+						hidden.begin(), hidden.end(), name)) {
+					return;
+				}
+				out.push_back(at[f->second]);
+			};
+			std::vector<const ast::node*> results;
+			forms::results(*c.body, results);
+			for (auto r: results) {
+				if (auto name = callee(*r)) {
+					edge(name->text, tails[i]);
+				}
+			}
+			if (!recursion) continue;
+			std::vector<std::string> names;
+			applied(*c.body, names);
+			for (auto &name: names) {
+				edge(name, calls[i]);
+			}
+		}
+	}
+	if (recursion) {
+		components all(calls);
+		for (size_t i = 0; i < list.size(); ++i) {
+			component[list[i].index] = all[i];
+		}
+	}
+	components groups(tails);
+	std::map<size_t, std::vector<const pending*>> members;
+	for (size_t i = 0; i < list.size(); ++i) {
+		members[groups[i]].push_back(&list[i]);
+	}
+	for (size_t i = 0; i < list.size(); ++i) {
+		auto &group = members[groups[i]];
+		if (group.size() == 1) {
+			select(list[i].index, list[i].clauses, nullptr, nullptr);
+		} else if (group[0] == &list[i]) {
+			loop(group);
+		}
+	}
+	definition = -1;
+}
+
+// Generates mutually tail-recursive functions as one, which takes the
+// arguments of any of them followed by the number of the one to begin
+// with, and dispatches on that through a jump table. Each of the original
+// functions becomes a stub which calls it.
+void generator::loop(const std::vector<const pending*> &members) {
+	unsigned width = 0;
+	std::string name = "<loop";
+	for (auto p: members) {
+		width = std::max(width, prog.functions[p->index].params);
+		name += " " + prog.functions[p->index].name;
+	}
+	location loc = prog.functions[members[0]->index].origin;
+	unsigned index = declare(name + ">", width + 1, loc);
+	scope s;
+	s.index = index;
+	s.high = width + 1;
+	for (auto p: members) {
+		s.entries[p->index] = 0;
+	}
+	cur = &s;
+	unsigned dispatch = fn().tables.size();
+	fn().tables.emplace_back();
+	emit(jumptable, width, dispatch, 0, 0, loc);
+	for (auto p: members) {
+		clauses(p->index, p->clauses);
+	}
+	table &tab = fn().tables[dispatch];
+	for (auto p: members) {
+		tab.targets.push_back(s.entries[p->index]);
+	}
+	tab.otherwise = tab.targets[0];
+	for (auto &l: s.loops) {
+		patch(l.first, s.entries[l.second]);
+	}
+	fn().registers = s.high;
+	for (unsigned k = 0; k < members.size(); ++k) {
+		scope stub;
+		stub.index = members[k]->index;
+		cur = &stub;
+		// Registers not yet written hold nil, which pads out the arguments.
+		emit(integer, width, 0, k, 0, loc);
+		emit(bytecode::call, width + 1, index, 0, width + 1, loc);
+		emit(ret, width + 1, 0, 0, 0, loc);
+		fn().registers = width + 2;
+	}
+	cur = nullptr;
+}
+
+void generator::select(unsigned index, const std::vector<match::clause> &list,
+		scope *outer, std::vector<std::string> *captures) {
+	scope s;
+	s.outer = outer;
+	s.index = index;
+	s.entries[index] = 0;
+	scope *saved = cur;
+	cur = &s;
+	clauses(index, list);
+	for (auto &l: s.loops) {
+		patch(l.first, s.entries[l.second]);
+	}
+	fn().registers = s.high;
+	fn().captures = s.captures.size();
+	cur = saved;
+	if (captures) {
+		*captures = s.captures;
+	}
+}
+
+// Appends the clauses of a function to the code of the current one.
+void generator::clauses(unsigned index,
+		const std::vector<match::clause> &list) {
+	// The arguments arrive in the lowest registers, whatever each clause
+	// calls them; a clause's names become aliases for them only within
+	// that clause's body.
+	unsigned width = prog.functions[index].params;
+	std::vector<std::string> names;
+	for (auto &c: list) {
+		std::set<std::string> seen;
+		for (auto &p: c.patterns) {
+			if (!p.name.empty() && !seen.insert(p.name).second) {
+				err.report(p.origin, "duplicate parameter '" + p.name + "'");
+			}
+		}
+		forms::assigned(*c.body, names);
+	}
+	cur->locals.clear();
+	for (auto &name: names) {
+		if (!cur->locals.count(name)) {
+			cur->locals[name] = width + cur->locals.size();
+		}
+	}
+	cur->temps = width + cur->locals.size();
+	cur->high = std::max(cur->high, cur->temps);
+	cur->entries[index] = here();
+	if (!cur->outer) {
+		definition = index;
+	}
+	match::tree t = match::compile(list, prog.functions[index].name, err);
+	decide(t, list, index, temp());
+}
+
+// Code addresses of decision nodes, and the places which jump to them
+// before they have one.
+struct generator::labels {
+	std::vector<int> at;
+	std::vector<unsigned> work;
+	std::vector<std::pair<unsigned, unsigned>> jumps;
+	std::vector<unsigned> tables;
+	void branch(unsigned pc, unsigned node) {
+		jumps.emplace_back(pc, node);
+		work.push_back(node);
+	}
+};
+
+void generator::decide(const match::tree &t,
+		const std::vector<match::clause> &list, unsigned index,
+		unsigned result) {
+	labels l;
+	l.at.assign(t.nodes.size(), -1);
+	l.work.push_back(t.root);
+	while (!l.work.empty()) {
+		unsigned node = l.work.back();
+		l.work.pop_back();
+		if (l.at[node] >= 0) continue;
+		l.at[node] = here();
+		const match::decision &d = t.nodes[node];
+		if (d.type == match::decision::kind::test) {
+			test(d, l);
+			continue;
+		}
+		if (d.type == match::decision::kind::fail) {
+			emit(fail, 0, index, 0, 0, prog.functions[index].origin);
+			continue;
+		}
+		const match::clause &c = list[d.clause];
+		std::map<std::string, unsigned> saved = cur->locals;
+		for (unsigned col = 0; col < c.patterns.size(); ++col) {
+			if (!c.patterns[col].name.empty()) {
+				cur->locals[c.patterns[col].name] = col;
+			}
+		}
+		compile(*c.body, result, true);
+		emit(ret, result, 0, 0, 0, c.body->origin);
+		cur->locals = saved;
+	}
+	for (auto &j: l.jumps) {
+		patch(j.first, l.at[j.second]);
+	}
+	for (unsigned index: l.tables) {
+		table &tab = fn().tables[index];
+		for (auto &target: tab.targets) {
+			target = l.at[target];
+		}
+		tab.otherwise = l.at[tab.otherwise];
+	}
+}
+
+void generator::test(const match::decision &d, labels &l) {
+	location loc = fn().origin;
+	unsigned mark = cur->temps;
+	unsigned arg = d.column;
+	// Integers dense enough go through a jump table; the rest are compared
+	// one at a time, since any of them may be a string.
+	int64_t low = INT64_MAX, high = INT64_MIN;
+	size_t count = 0;
+	for (auto &e: d.cases) {
+		if (e.value.type != match::pattern::kind::integer) continue;
+		low = std::min(low, e.value.integer);
+		high = std::max(high, e.value.integer);
+		++count;
+	}
+	bool dense = count >= 4 && uint64_t(high) - uint64_t(low) < 256 &&
+			uint64_t(high) - uint64_t(low) < count * 8;
+	for (auto &e: d.cases) {
+		bool integer = e.value.type == match::pattern::kind::integer;
+		if (integer && e.value.bytes) {
+			// A character also matches its one-byte string.
+			unsigned k = temp(), flag = temp();
+			emit(load, k, pool(e.value.bytes), 0, 0, e.value.origin);
+			emit(eq, flag, arg, k, 0, e.value.origin);
+			l.branch(emit(jumpif, flag, 0, 0, 0, e.value.origin), e.next);
+			cur->temps = mark;
+		}
+		if (integer && dense) continue;
+		unsigned k = temp(), flag = temp();
+		int16_t imm = e.value.integer;
+		if (integer && imm == e.value.integer) {
+			emit(bytecode::integer, k, 0, uint16_t(imm), 0, e.value.origin);
+		} else if (integer) {
+			emit(load, k, pool(e.value.integer), 0, 0, e.value.origin);
+		} else {
+			emit(load, k, pool(e.value.bytes), 0, 0, e.value.origin);
+		}
+		emit(eq, flag, arg, k, 0, e.value.origin);
+		l.branch(emit(jumpif, flag, 0, 0, 0, e.value.origin), e.next);
+		cur->temps = mark;
+	}
+	if (dense) {
+		table tab;
+		tab.low = low;
+		tab.targets.assign(uint64_t(high) - uint64_t(low) + 1, d.otherwise);
+		for (auto &e: d.cases) {
+			if (e.value.type != match::pattern::kind::integer) continue;
+			tab.targets[e.value.integer - low] = e.next;
+			l.work.push_back(e.next);
+		}
+		tab.otherwise = d.otherwise;
+		l.tables.push_back(fn().tables.size());
+		emit(jumptable, arg, fn().tables.size(), 0, 0, loc);
+		fn().tables.push_back(tab);
+		// The default has an entry in the table; it need not follow.
+		l.work.push_back(d.otherwise);
+		return;
+	}
+	// The default goes next, so it needs no jump, unless it is already
+	// placed elsewhere.
+	if (l.at[d.otherwise] >= 0) {
+		l.branch(emit(jump, 0, 0, 0, 0, loc), d.otherwise);
+	} else {
+		l.work.push_back(d.otherwise);
+	}
+}
+
+void generator::call(const ast::node &fn, const ast::node &args, location loc) {
+	std::vector<const ast::node*> items;
+	forms::elements(args, items);
+	pipeline p;
+	if (items.size() == 1 && chain(fn, &p) && !p.range) {
+		// Indexing a pipeline computes only the element requested.
+		unsigned source = value(*p.source);
+		unsigned index = value(*items[0]);
+		unsigned item = temp();
+		emit(apply, item, source, index, 1, loc);
+		for (auto s: p.stages) {
+			item = step(*s, item);
+		}
+		emit(move, dest, item, 0, 0, loc);
+		return;
+	}
+	auto name = dynamic_cast<const ast::identifier*>(&fn);
+	unsigned target = 0;
+	bool direct = name && !visible(cur, name->text) &&
+			functions.count(name->text);
+	if (direct) {
+		target = functions[name->text];
+		if (prog.functions[target].params != items.size()) {
+			err.report(loc, "wrong number of arguments to '" +
+					name->text + "'", prog.functions[target].origin);
+		}
+	} else {
+		target = value(fn);
+	}
+	unsigned base = cur->temps;
+	for (auto item: items) {
+		compile(*item, temp());
+	}
+	bool again = direct && tail && cur->entries.count(target) &&
+			prog.functions[target].params == items.size();
+	if (again) {
+		// Every argument is evaluated before any parameter is replaced.
+		for (unsigned k = 0; k < items.size(); ++k) {
+			emit(move, k, base + k, 0, 0, loc);
+		}
+		// The jump is marked, since it ends the pass whose allocations the
+		// region holds.
+		unsigned at = emit(bytecode::jump, 1, 0, 0, 0, loc);
+		cur->loops.emplace_back(at, target);
+		return;
+	}
+	if (direct && recursion && definition >= 0 &&
+			component.count(target) && component.count(definition) &&
+			component[target] == component[unsigned(definition)]) {
+		err.warn(loc, "recursive call to '" + name->text +
+				"' is not in tail position, so it uses stack");
+	}
+	emit(direct? bytecode::call: apply, dest, target, base, items.size(), loc);
+}
+
+bool generator::stage(const ast::node &n) {
+	std::vector<std::string> names;
+	if (auto c = dynamic_cast<const ast::capture*>(&n)) {
+		return forms::parameters(*c->left, names) && names.size() == 1;
+	}
+	auto i = dynamic_cast<const ast::identifier*>(&n);
+	if (!i || visible(cur, i->text) || !functions.count(i->text)) {
+		return false;
+	}
+	return prog.functions[functions[i->text]].params == 1;
+}
+
+bool generator::chain(const ast::node &n, pipeline *out) {
+	auto b = dynamic_cast<const ast::binop*>(&n);
+	if (!b || b->id != syntax::mul || !stage(*b->right)) {
+		return false;
+	}
+	if (!chain(*b->left, out)) {
+		out->range = dynamic_cast<const ast::range*>(b->left.get());
+		out->source = b->left.get();
+	}
+	out->stages.push_back(b->right.get());
+	return true;
+}
+
+unsigned generator::step(const ast::node &n, unsigned input) {
+	// Captures are expanded in place: the parameter and any locals become
+	// registers of the enclosing function, and free names resolve exactly
+	// as they would outside the capture, so no closure is ever built.
+	unsigned output = temp();
+	if (auto i = dynamic_cast<const ast::identifier*>(&n)) {
+		unsigned arg = temp();
+		emit(move, arg, input, 0, 0, n.origin);
+		emit(bytecode::call, output, functions[i->text], arg, 1, n.origin);
+		return output;
+	}
+	auto &c = static_cast<const ast::capture&>(n);
+	std::vector<std::string> names;
+	forms::parameters(*c.left, names);
+	std::map<std::string, unsigned> saved = cur->locals;
+	cur->locals[names[0]] = input;
+	names.clear();
+	forms::assigned(*c.right, names);
+	for (auto &name: names) {
+		cur->locals[name] = temp();
+	}
+	compile(*c.right, output);
+	cur->locals = saved;
+	return output;
+}
+
+void generator::fuse(const pipeline &p, location loc) {
+	// Every stage runs inside a single loop over the source, so the only
+	// sequence ever allocated is the final result. Ranges are counted off
+	// rather than materialized. The buffer is built in a temporary in case
+	// the destination is also the source.
+	unsigned source, count = temp(), base = 0;
+	if (p.range) {
+		base = temp();
+		compile(*p.range->left, base);
+		unsigned hi = value(*p.range->right);
+		emit(sub, count, hi, base, 0, loc);
+		source = base;
+	} else {
+		source = value(*p.source);
+		emit(length, count, source, 0, 0, loc);
+	}
+	unsigned buf = temp();
+	emit(buffer, buf, count, source, 0, loc);
+	unsigned index = temp();
+	emit(integer, index, 0, 0, 0, loc);
+	if (!p.range) {
+		// Lets the machine run a byte kernel ahead of the loop.
+		emit(vector, buf, source, index, 0, loc);
+	}
+	unsigned enter = emit(jump, 0, 0, 0, 0, loc);
+	unsigned top = here();
+	unsigned mark = cur->temps;
+	unsigned item = temp();
+	if (p.range) {
+		emit(add, item, base, index, 0, loc);
+	} else {
+		emit(element, item, source, index, 0, loc);
+	}
+	for (auto s: p.stages) {
+		item = step(*s, item);
+	}
+	emit(store, buf, index, item, 0, loc);
+	cur->temps = mark;
+	emit(addi, index, index, 1, 0, loc);
+	patch(enter, here());
+	unsigned test = temp();
+	emit(lt, test, index, count, 0, loc);
+	emit(jumpif, test, top, 0, 0, loc);
+	emit(move, dest, buf, 0, 0, loc);
+}
+
+void generator::translate(const ast::node &tree) {
+	std::vector<const ast::node*> program;
+	forms::statements(tree, program);
+	scope top;
+	top.index = declare("<init>", 0, tree.origin);
+	prog.init = top.index;
+
+	// Every definition gets its global slot before any code is generated,
+	// so definitions may refer to each other in any order.
+	// A function may be defined by several clauses, which need not be
+	// adjacent; they are tried in the order they appear.
+	std::vector<pending> bodies;
+	std::map<std::string, location> seen;
+	std::map<std::string, size_t> clauses;
+	for (auto stmt: program) {
+		forms::definition d;
+		if (!forms::define(*stmt, &d)) continue;
+		std::vector<const ast::capture*> arms;
+		std::vector<match::clause> heads;
+		if (d.params) {
+			heads.emplace_back();
+			match::read(*d.params, &heads.back(), err);
+			heads.back().body = d.body;
+			heads.back().origin = stmt->origin;
+		} else if (forms::alternatives(*d.body, arms)) {
+			for (auto arm: arms) {
+				heads.emplace_back();
+				match::read(*arm->left, &heads.back(), err);
+				heads.back().body = arm->right.get();
+				heads.back().origin = arm->origin;
+			}
+		}
+		if (seen.count(d.name)) {
+			auto f = clauses.find(d.name);
+			if (f == clauses.end() || heads.empty()) {
+				err.report(stmt->origin, "redefinition of '" + d.name + "'",
+						seen[d.name]);
+				continue;
+			}
+			pending &p = bodies[f->second];
+			for (auto &h: heads) {
+				if (h.patterns.size() != p.clauses[0].patterns.size()) {
+					err.report(h.origin, "clauses of '" + d.name +
+							"' have different numbers of parameters",
+							seen[d.name]);
+				} else {
+					p.clauses.push_back(h);
+				}
+			}
+			continue;
+		}
+		seen[d.name] = stmt->origin;
+		globals[d.name] = prog.globals.size();
+		prog.globals.emplace_back();
+		prog.globals.back().name = d.name;
+		if (heads.empty()) {
+			// A value is computed by a function of no arguments.
+			unsigned index = declare(d.name, 0, stmt->origin);
+			prog.globals.back().init = index;
+			heads.emplace_back();
+			heads.back().body = d.body;
+			heads.back().origin = stmt->origin;
+			bodies.push_back(pending{index, heads});
+			continue;
+		}
+		unsigned arity = heads[0].patterns.size();
+		unsigned index = declare(d.name, arity, stmt->origin);
+		functions[d.name] = index;
+		prog.globals.back().function = index;
+		clauses[d.name] = bodies.size();
+		bodies.push_back(pending{index, std::vector<match::clause>()});
+		for (auto &h: heads) {
+			if (h.patterns.size() != arity) {
+				err.report(h.origin, "clauses of '" + d.name +
+						"' have different numbers of parameters",
+						stmt->origin);
+			} else {
+				bodies.back().clauses.push_back(h);
+			}
+		}
+	}
+	generate(bodies);
+
+	// Expression statements run in order, as the body of <init>.
+	std::vector<std::string> names;
+	for (auto stmt: program) {
+		if (!dynamic_cast<const ast::define*>(stmt)) {
+			forms::assigned(*stmt, names);
+		}
+	}
+	for (auto &name: names) {
+		if (!top.locals.count(name)) {
+			top.locals[name] = top.locals.size();
+		}
+	}
+	top.temps = top.high = top.locals.size();
+	cur = &top;
+	unsigned result = temp();
+	emit(nil, result, 0, 0, 0, tree.origin);
+	// The result is that of the last statement, so it returns from there.
+	location last = tree.origin;
+	for (auto stmt: program) {
+		if (!dynamic_cast<const ast::define*>(stmt) &&
+				!dynamic_cast<const ast::typealias*>(stmt) &&
+				!dynamic_cast<const ast::declare*>(stmt)) {
+			compile(*stmt, result);
+			last = stmt->origin;
+		}
+	}
+	emit(ret, result, 0, 0, 0, last);
+	fn().registers = top.high;
+	cur = nullptr;
+	auto main = globals.find("main");
+	if (main != globals.end()) {
+		prog.main = main->second;
+	}
+}
+
+void generator::visit(const ast::eof &n) {
+	emit(nil, dest, 0, 0, 0, n.origin);
+}
+
+void generator::visit(const ast::wildcard &n) {
+	err.report(n.origin, "wildcard is only meaningful in a pattern");
+}
+
+void generator::visit(const ast::null &n) {
+	emit(nil, dest, 0, 0, 0, n.origin);
+}
+
+void generator::visit(const ast::number &n) {
+	err.report(n.origin, "number literal was not decoded");
+}
+
+void generator::visit(const ast::string &n) {
+	err.report(n.origin, "string literal was not decoded");
+}
+
+void generator::visit(const ast::identifier &n) {
+	if (!resolve(n.text, n.origin, dest)) {
+		err.report(n.origin, "undefined name '" + n.text + "'");
+	}
+}
+
+void generator::visit(const ast::integer &n) {
+	int16_t imm;
+	if (immediate(n, &imm)) {
+		emit(integer, dest, 0, uint16_t(imm), 0, n.origin);
+	} else {
+		emit(load, dest, pool(n.value), 0, 0, n.origin);
+	}
+}
+
+void generator::visit(const ast::bytes &n) {
+	emit(load, dest, pool(n.value), 0, 0, n.origin);
+}
+
+void generator::visit(const ast::apply &n) {
+	call(*n.left, *n.right, n.origin);
+}
+
+void generator::visit(const ast::pipe &n) {
+	call(*n.right, *n.left, n.origin);
+}
+
+void generator::visit(const ast::sequence &n) {
+	std::vector<const ast::capture*> arms;
+	if (forms::alternatives(n, arms)) {
+		alternatives(arms, n.origin);
+		return;
+	}
+	std::vector<const ast::node*> items;
+	forms::statements(n, items);
+	if (items.empty()) {
+		emit(nil, dest, 0, 0, 0, n.origin);
+		return;
+	}
+	for (size_t i = 0; i + 1 < items.size(); ++i) {
+		// Intermediate statements matter only for their assignments.
+		auto a = dynamic_cast<const ast::assign*>(items[i]);
+		unsigned reg = dest;
+		std::vector<std::string> names;
+		if (a) forms::binders(*a->left, names);
+		if (names.size() == 1 && local(names[0], &reg)) {
+			compile(*a->right, reg);
+		} else {
+			compile(*items[i], dest);
+		}
+	}
+	compile(*items.back(), dest, tail);
+}
+
+void generator::visit(const ast::pair &n) {
+	std::vector<const ast::node*> items;
+	forms::elements(n, items);
+	unsigned base = cur->temps;
+	for (auto item: items) {
+		compile(*item, temp());
+	}
+	emit(tuple, dest, base, 0, items.size(), n.origin);
+}
+
+void generator::visit(const ast::range &n) {
+	unsigned left = value(*n.left);
+	unsigned right = value(*n.right);
+	emit(range, dest, left, right, 0, n.origin);
+}
+
+void generator::visit(const ast::assign &n) {
+	std::vector<std::string> names;
+	forms::binders(*n.left, names);
+	unsigned reg;
+	if (names.size() != 1 || !local(names[0], &reg)) {
+		err.report(n.left->origin, "unsupported assignment pattern");
+		return;
+	}
+	compile(*n.right, reg);
+	if (reg != dest) {
+		emit(move, dest, reg, 0, 0, n.origin);
+	}
+}
+
+void generator::visit(const ast::capture &n) {
+	alternatives(std::vector<const ast::capture*>{&n}, n.origin);
+}
+
+void generator::alternatives(
+		const std::vector<const ast::capture*> &arms, location loc) {
+	std::vector<match::clause> list;
+	for (auto arm: arms) {
+		match::clause c;
+		match::read(*arm->left, &c, err);
+		c.body = arm->right.get();
+		c.origin = arm->origin;
+		if (!list.empty() && c.patterns.size() != list[0].patterns.size()) {
+			err.report(c.origin, "clauses of a function literal have "
+					"different numbers of parameters", list[0].origin);
+			continue;
+		}
+		list.push_back(c);
+	}
+	unsigned index = declare("<lambda>", list[0].patterns.size(), loc);
+	std::vector<std::string> captures;
+	select(index, list, cur, &captures);
+	unsigned base = cur->temps;
+	for (auto &name: captures) {
+		resolve(name, loc, temp());
+	}
+	emit(closure, dest, index, base, captures.size(), loc);
+}
+
+void generator::visit(const ast::declare &n) {
+	compile(*n.left, dest);
+}
+
+void generator::visit(const ast::define &n) {
+	err.report(n.origin, "definitions must appear at the top level");
+}
+
+void generator::visit(const ast::typealias &n) {
+	emit(nil, dest, 0, 0, 0, n.origin);
+}
+
+void generator::visit(const ast::macro &n) {
+	err.report(n.origin, "macros must be defined at the top level");
+}
+
+void generator::visit(const ast::binop &n) {
+	uint8_t op = nop, opi = nop;
+	switch (n.id) {
+#define BYTECODE_BOTH(name) op = name; opi = name##i; break;
+		case syntax::add: BYTECODE_BOTH(add)
+		case syntax::sub: BYTECODE_BOTH(sub)
+		case syntax::mul: BYTECODE_BOTH(mul)
+		case syntax::div: BYTECODE_BOTH(bytecode::div)
+		case syntax::rem: BYTECODE_BOTH(rem)
+		case syntax::shl: BYTECODE_BOTH(shl)
+		case syntax::shr: BYTECODE_BOTH(shr)
+		case syntax::and_join: BYTECODE_BOTH(band)
+		case syntax::eq: BYTECODE_BOTH(eq)
+		case syntax::gt: BYTECODE_BOTH(gt)
+		case syntax::lt: BYTECODE_BOTH(lt)
+		case syntax::neq: BYTECODE_BOTH(neq)
+		case syntax::ngt: BYTECODE_BOTH(ngt)
+		case syntax::nlt: BYTECODE_BOTH(nlt)
+#undef BYTECODE_BOTH
+		case syntax::or_join: op = bor; break;
+		case syntax::xor_join: op = bxor; break;
+		case syntax::nand_join: op = bnand; break;
+		case syntax::nor_join: op = bnor; break;
+		case syntax::xnor_join: op = bxnor; break;
+		default: break;
+	}
+	if (dynamic_cast<const ast::null*>(n.left.get())) {
+		// The parser supplies a null left operand for prefix operators.
+		if (n.id == syntax::sub || n.id == syntax::nand_join) {
+			unsigned right = value(*n.right);
+			emit(n.id == syntax::sub? neg: inv, dest, right, 0, 0, n.origin);
+		} else {
+			err.report(n.origin, "'" + n.text + "' is not a prefix operator");
+		}
+		return;
+	}
+	if (op == nop) {
+		err.report(n.origin, "unsupported operator '" + n.text + "'");
+		return;
+	}
+	pipeline p;
+	if (chain(n, &p)) {
+		fuse(p, n.origin);
+		return;
+	}
+	unsigned left = value(*n.left);
+	int16_t imm;
+	if (opi != nop && immediate(*n.right, &imm)) {
+		emit(opi, dest, left, uint16_t(imm), 0, n.origin);
+	} else {
+		unsigned right = value(*n.right);
+		emit(op, dest, left, right, 0, n.origin);
+	}
+}
+
+void generator::visit(const ast::conditional &n) {
+	unsigned test = value(*n.test);
+	unsigned skip = emit(jumpnot, test, 0, 0, 0, n.origin);
+	compile(*n.consequent, dest, tail);
+	unsigned done = emit(jump, 0, 0, 0, 0, n.origin);
+	patch(skip, here());
+	compile(*n.alternative, dest, tail);
+	patch(done, here());
+}
+
+void compiler::process(ast::ptr &&tree) {
+	generator g(out, err, recursion);
+	g.translate(*tree);
+	escape::analyze(out);
+}
@@ -0,0 +1,30 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "bytecode.h"
+#include "errors.h"
+
+// Translates a program tree into register bytecode. Every name is resolved
+// at compile time: top-level definitions become global slots, parameters and
+// locals become registers, and names a capture borrows from its enclosing
+// function become closure slots. Calls to top-level functions are direct.
+// Calls in tail position to the function itself, or to others which call it
+// back the same way, become jumps, so such recursion runs in constant stack.
+// Expects the output of the fold pass: literals must already be decoded.
+struct compiler: public ast::delegate {
+	compiler(bytecode::program &p, errors &e): out(p), err(e) {}
+	virtual void process(ast::ptr&&) override;
+	bool recursion = false; // warn of recursive calls which use stack
+private:
+	bytecode::program &out;
+	errors &err;
+};
+
+#endif //COMPILER_H
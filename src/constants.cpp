@@ -0,0 +1,16 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "constants.h"
+
+const std::string *constants::intern(const std::string &value) {
+	auto found = pool.insert(value);
+	const std::string *entry = &*found.first;
+	if (found.second) {
+		order.push_back(entry);
+	}
+	return entry;
+}
@@ -0,0 +1,25 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef CONSTANTS_H
+#define CONSTANTS_H
+
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// Pool of decoded byte-string constants. Each distinct value is stored once;
+// the addresses handed out stay valid for the lifetime of the pool, so trees
+// may refer to pool entries directly and compare them by identity.
+struct constants {
+	const std::string *intern(const std::string&);
+	const std::vector<const std::string*> &entries() const { return order; }
+private:
+	std::unordered_set<std::string> pool;
+	std::vector<const std::string*> order;
+};
+
+#endif //CONSTANTS_H
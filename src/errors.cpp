@@ -5,22 +5,28 @@
 // IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
 
 #include "errors.h"
-#include <iostream>
 
-void errors::print_loc(location l) {
+std::string errors::where(location l) {
 	position p = l.begin;
-	std::cerr << p.row() << ":" << p.col();
+	return std::to_string(p.row()) + ":" + std::to_string(p.col());
+}
+
+void errors::print(const std::string &line) {
+	if (seen.insert(line).second) {
+		out << line << std::endl;
+	}
 }
 
 void errors::report(location l, std::string message) {
-	print_loc(l);
-	std::cerr << ": " << message << std::endl;
+	++count;
+	print(where(l) + ": " + message);
 }
 
-void errors::report(location l, std::string message, location prev) {
-	print_loc(l);
-	std::cerr << ": " << message << " (see ";
-	print_loc(prev);
-	std::cerr << ")" << std::endl;
+void errors::warn(location l, std::string message) {
+	print(where(l) + ": warning: " + message);
 }
 
+void errors::report(location l, std::string message, location prev) {
+	++count;
+	print(where(l) + ": " + message + " (see " + where(prev) + ")");
+}
@@ -8,13 +8,26 @@
 #define ERRORS_H
 
 #include "location.h"
+#include <iostream>
+#include <set>
 #include <string>
 
+// Each distinct message is printed once, however many times it is reported:
+// a constant is folded by more than one pass, and an inlined body is checked
+// again at every call site, but each problem has one place in the source.
 struct errors {
+	explicit errors(std::ostream &o = std::cerr): out(o) {}
 	void report(location where, std::string message);
 	void report(location where, std::string message, location previous);
+	// Warnings are printed like errors but do not stop compilation.
+	void warn(location where, std::string message);
+	bool any() const { return count > 0; }
 private:
-	void print_loc(location);
+	std::string where(location);
+	void print(const std::string &line);
+	std::ostream &out;
+	std::set<std::string> seen;
+	unsigned count = 0;
 };
 
 #endif //ERRORS_H
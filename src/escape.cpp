@@ -0,0 +1,258 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "escape.h"
+
+using namespace bytecode;
+using escape::reason;
+
+namespace {
+
+// How a value escapes, if it does.
+struct fate {
+	reason why = reason::none;
+	unsigned where = 0;
+	int callee = -1;
+};
+
+const char *noun(uint8_t op) {
+	switch (op) {
+		case closure: return "closure";
+		case tuple: return "tuple";
+		case range: return "range";
+		default: return "sequence";
+	}
+}
+
+bool allocates(const instr &i) {
+	switch (i.op) {
+		case closure: return i.n > 0; // otherwise a static closure
+		case tuple: case range: case buffer: return true;
+		default: return false;
+	}
+}
+
+// Does the instruction put a new value in register a?
+bool writes(const instr &i) {
+	switch (i.op) {
+		case nop: case setglobal: case store: case vector:
+		case jump: case jumpif: case jumpnot: case jumptable:
+		case ret: case fail:
+			return false;
+		default:
+			return true;
+	}
+}
+
+// Does the instruction read register r?
+bool reads(const instr &i, unsigned r) {
+	auto among = [r](unsigned first, unsigned n) {
+		return r >= first && r < first + n;
+	};
+	switch (i.op) {
+		case nop: case nil: case integer: case load: case getglobal:
+		case upvalue: case jump: case fail:
+			return false;
+		case move: case length: case neg: case inv: return r == i.b;
+		case setglobal: case jumpif: case jumpnot: case jumptable: case ret:
+			return r == i.a;
+		case closure: case call: return among(i.c, i.n);
+		case tuple: return among(i.b, i.n);
+		case range: case element: case buffer: return r == i.b || r == i.c;
+		case store: case vector: return r == i.a || r == i.b || r == i.c;
+		case apply: return r == i.b || among(i.c, i.n);
+		default:
+			// Arithmetic; the immediate forms read only b.
+			return r == i.b || (i.op < addi && r == i.c);
+	}
+}
+
+void successors(const function &fn, unsigned pc, std::vector<unsigned> &out) {
+	const instr &i = fn.code[pc];
+	out.clear();
+	switch (i.op) {
+		case ret: case fail: return;
+		case jump: out.push_back(i.b); return;
+		case jumptable: {
+			const table &t = fn.tables[i.b];
+			out.assign(t.targets.begin(), t.targets.end());
+			out.push_back(t.otherwise);
+			return;
+		}
+		case jumpif: case jumpnot: out.push_back(i.b); break;
+		default: break;
+	}
+	if (pc + 1 < fn.code.size()) out.push_back(pc + 1);
+}
+
+// Follows one value forward through the function from the instruction at
+// 'start', where the registers in 'held' hold it, tracking the copies moves
+// make and the registers which are overwritten, until it reaches a place
+// where it escapes. Registers are reused, so this follows the value, not
+// the register: whatever else a register holds at other times does not
+// matter. The escape nearest the start is the one reported. Parameters
+// escape from a function if their values do, which is what 'kept' records
+// for the functions called directly. Each point is visited twice over: once
+// before the value has gone around a loop, and once after, when reading it
+// at all means it was carried out of the pass which made it.
+fate follow(const function &fn, unsigned start, const std::vector<bool> &held,
+		const std::vector<std::vector<bool>> &kept) {
+	size_t size = fn.code.size();
+	std::vector<std::vector<bool>> in(2 * size);
+	std::vector<unsigned> edge(size); // the jump which went around
+	std::vector<unsigned> work, next;
+	if (start >= size) return fate();
+	in[start] = held;
+	work.push_back(start);
+	for (size_t w = 0; w < work.size(); ++w) {
+		unsigned state = work[w];
+		bool around = state >= size;
+		unsigned pc = state % size;
+		const instr &i = fn.code[pc];
+		const std::vector<bool> &h = in[state];
+		auto has = [&h](unsigned r) { return r < h.size() && h[r]; };
+		fate out;
+		out.where = pc;
+		for (unsigned r = 0; around && r < h.size(); ++r) {
+			if (!h[r] || !reads(i, r)) continue;
+			out.why = reason::carried;
+			out.where = edge[pc];
+			return out;
+		}
+		switch (i.op) {
+			case ret: if (has(i.a)) out.why = reason::returned; break;
+			case setglobal: if (has(i.a)) out.why = reason::global; break;
+			case closure:
+				for (unsigned k = 0; k < i.n; ++k) {
+					if (has(i.c + k)) out.why = reason::captured;
+				}
+				break;
+			case tuple:
+				for (unsigned k = 0; k < i.n; ++k) {
+					if (has(i.b + k)) out.why = reason::stored;
+				}
+				break;
+			case store: if (has(i.c)) out.why = reason::stored; break;
+			case call:
+				for (unsigned k = 0; k < i.n; ++k) {
+					if (!has(i.c + k)) continue;
+					if (k >= kept[i.b].size() || kept[i.b][k]) {
+						out.why = reason::passed;
+						out.callee = i.b;
+					}
+				}
+				break;
+			case apply:
+				// The target may be anything, even a boolean which hands
+				// back one of the arguments.
+				for (unsigned k = 0; k < i.n; ++k) {
+					if (has(i.c + k)) out.why = reason::passed;
+				}
+				break;
+			default: break;
+		}
+		if (out.why != reason::none) return out;
+		std::vector<bool> after = h;
+		if (writes(i) && i.a < after.size()) {
+			after[i.a] = i.op == move && has(i.b);
+		}
+		bool loops = i.op == jump && i.a;
+		successors(fn, pc, next);
+		for (unsigned to: next) {
+			if (around || loops) {
+				edge[to] = around? edge[pc]: pc;
+				to += size;
+			}
+			std::vector<bool> &target = in[to];
+			bool grew = target.empty();
+			if (grew) target.assign(fn.registers, false);
+			for (unsigned r = 0; r < after.size(); ++r) {
+				if (after[r] && !target[r]) {
+					target[r] = true;
+					grew = true;
+				}
+			}
+			if (grew) work.push_back(to);
+		}
+	}
+	return fate();
+}
+
+} // namespace
+
+void escape::analyze(program &prog, std::vector<site> *sites) {
+	// Start by assuming no parameter escapes anywhere, and let escapes
+	// spread through calls until every function agrees with its callees.
+	std::vector<std::vector<bool>> kept(prog.functions.size());
+	for (size_t f = 0; f < prog.functions.size(); ++f) {
+		kept[f].resize(prog.functions[f].params);
+	}
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (size_t f = 0; f < prog.functions.size(); ++f) {
+			const function &fn = prog.functions[f];
+			for (unsigned k = 0; k < kept[f].size(); ++k) {
+				if (kept[f][k]) continue;
+				std::vector<bool> held(fn.registers, false);
+				if (k < held.size()) held[k] = true;
+				if (follow(fn, 0, held, kept).why != reason::none) {
+					kept[f][k] = true;
+					changed = true;
+				}
+			}
+		}
+	}
+	for (size_t f = 0; f < prog.functions.size(); ++f) {
+		function &fn = prog.functions[f];
+		fn.local.assign(fn.code.size(), false);
+		fn.regional = false;
+		for (unsigned pc = 0; pc < fn.code.size(); ++pc) {
+			const instr &i = fn.code[pc];
+			if (!allocates(i)) continue;
+			std::vector<bool> held(fn.registers, false);
+			if (i.a < held.size()) held[i.a] = true;
+			fate out = follow(fn, pc + 1, held, kept);
+			fn.local[pc] = out.why == reason::none;
+			fn.regional |= fn.local[pc];
+			if (!sites) continue;
+			site s;
+			s.function = f;
+			s.pc = pc;
+			s.why = out.why;
+			s.where = out.where;
+			s.callee = out.callee;
+			sites->push_back(s);
+		}
+	}
+}
+
+std::string escape::describe(const program &prog, const site &s) {
+	const function &fn = prog.functions[s.function];
+	auto at = [&](unsigned pc) {
+		position p = pc < fn.origins.size()? fn.origins[pc].begin:
+				fn.origin.begin;
+		return std::to_string(p.row()) + ":" + std::to_string(p.col());
+	};
+	std::string out = at(s.pc) + ": " + noun(fn.code[s.pc].op);
+	if (s.why == reason::none) {
+		return out + " stays in the region of '" + fn.name + "'";
+	}
+	out += " escapes '" + fn.name + "': ";
+	switch (s.why) {
+		case reason::none: break;
+		case reason::returned: out += "returned"; break;
+		case reason::global: out += "assigned to a global"; break;
+		case reason::captured: out += "captured by a closure"; break;
+		case reason::stored: out += "stored in another value"; break;
+		case reason::carried: out += "carried into the loop's next pass"; break;
+		case reason::passed:
+			out += s.callee < 0? "passed to an unknown function":
+					"passed to '" + prog.functions[s.callee].name + "'";
+			break;
+	}
+	return out + " at " + at(s.where);
+}
@@ -0,0 +1,48 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef ESCAPE_H
+#define ESCAPE_H
+
+#include "bytecode.h"
+#include <string>
+#include <vector>
+
+// Escape analysis over register bytecode. A closure, tuple, range, or map
+// buffer which is never returned, stored in a global, captured, stored into
+// another object, or passed where it might be kept cannot outlive the call
+// which made it, so it can live in that call's region, which is released in
+// one step when the call returns, instead of on the heap. A tail call which
+// loops back releases the region too, so a value read again after the loop
+// goes around must escape as well.
+namespace escape {
+
+enum class reason: uint8_t {
+	none, // stays in the region of the call which made it
+	returned,
+	global,
+	captured, // by a closure
+	stored, // in a tuple or a sequence being built
+	passed, // to a function which keeps it, or to one not known
+	carried, // into the next pass of a loop
+};
+
+struct site {
+	unsigned function;
+	unsigned pc;
+	reason why = reason::none;
+	unsigned where = 0; // the instruction through which it escapes
+	int callee = -1; // the function it was passed to, if known
+};
+
+// Marks every allocation which can stay in its call's region, and lists the
+// allocation sites, if asked, with the reason each one escapes, if it does.
+void analyze(bytecode::program&, std::vector<site> *sites = nullptr);
+std::string describe(const bytecode::program&, const site&);
+
+} // namespace escape
+
+#endif //ESCAPE_H
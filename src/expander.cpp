@@ -0,0 +1,321 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "expander.h"
+#include "builder.h"
+#include "forms.h"
+#include "rewrite.h"
+#include <chrono>
+#include <map>
+#include <stdlib.h>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace {
+
+struct rule {
+	const ast::node *pattern;
+	const ast::node *body;
+	std::set<std::string> inner; // names the template binds for itself
+};
+
+typedef std::map<std::string, const ast::node*> bindings;
+
+bool match(const ast::node &pattern, const ast::node &n, bindings &out) {
+	if (dynamic_cast<const ast::wildcard*>(&pattern)) return true;
+	if (auto i = dynamic_cast<const ast::identifier*>(&pattern)) {
+		// A variable used twice must match the same tree both times.
+		auto prior = out.find(i->text);
+		if (prior != out.end()) return ast::same(*prior->second, n);
+		out[i->text] = &n;
+		return true;
+	}
+	if (typeid(pattern) != typeid(n)) return false;
+	if (auto l = dynamic_cast<const ast::leaf*>(&pattern)) {
+		return l->text == static_cast<const ast::leaf&>(n).text;
+	}
+	auto o = dynamic_cast<const ast::binop*>(&pattern);
+	if (o && o->id != static_cast<const ast::binop&>(n).id) return false;
+	std::vector<const ast::node*> x, y;
+	forms::children(pattern, x);
+	forms::children(n, y);
+	for (size_t k = 0; k < x.size(); ++k) {
+		if (!match(*x[k], *y[k], out)) return false;
+	}
+	return true;
+}
+
+// Replaces pattern variables with the trees they matched and renames the
+// names the template binds.
+struct instance: public ast::rewrite {
+	const bindings *args = nullptr;
+	std::map<std::string, std::string> rename;
+	using ast::rewrite::visit;
+	virtual void visit(const ast::identifier &n) override {
+		auto a = args->find(n.text);
+		if (a != args->end()) {
+			result = ast::share(*a->second);
+			return;
+		}
+		auto i = rename.find(n.text);
+		if (i == rename.end()) {
+			result = ast::share(n);
+			return;
+		}
+		make(new ast::identifier(i->second, n.origin));
+	}
+	virtual void visit(const ast::declare &n) override {
+		ast::ptr left = (*this)(*n.left);
+		ast::ptr right = n.right;
+		make(new ast::declare(
+				std::move(left), std::move(right), n.origin));
+	}
+};
+
+// Copies a remembered expansion, moving the serial numbers of the names it
+// introduced into a range of its own.
+struct refresh: public ast::rewrite {
+	unsigned first = 0;
+	unsigned last = 0;
+	unsigned offset = 0;
+	using ast::rewrite::visit;
+	virtual void visit(const ast::identifier &n) override {
+		std::string text = n.text;
+		size_t at = text.rfind('@');
+		if (at != std::string::npos) {
+			unsigned k = strtoul(text.c_str() + at + 1, nullptr, 10);
+			if (k >= first && k <= last) {
+				text = text.substr(0, at + 1) + std::to_string(k + offset);
+			}
+		}
+		if (text == n.text) {
+			result = ast::share(n);
+			return;
+		}
+		make(new ast::identifier(text, n.origin));
+	}
+};
+
+// Renames the locals which have the same name as a definition some template
+// refers to, within the scopes which bind them, so that the template's
+// reference reaches the definition wherever it is expanded. Every such local
+// gets the same suffix, which expansions never use, so a name still hides
+// whatever it hid before.
+struct shelter: public ast::rewrite {
+	const std::set<std::string> *free = nullptr;
+	std::map<std::string, std::string> rename;
+	void bind(const std::vector<std::string> &names) {
+		for (auto &name: names) {
+			if (free->count(name)) rename[name] = name + "@0";
+		}
+	}
+	using ast::rewrite::visit;
+	virtual void visit(const ast::identifier &n) override {
+		auto i = rename.find(n.text);
+		if (i == rename.end()) {
+			result = ast::share(n);
+			return;
+		}
+		make(new ast::identifier(i->second, n.origin));
+	}
+	virtual void visit(const ast::declare &n) override {
+		ast::ptr left = (*this)(*n.left);
+		ast::ptr right = n.right;
+		make(new ast::declare(
+				std::move(left), std::move(right), n.origin));
+	}
+	virtual void visit(const ast::capture &n) override {
+		auto saved = rename;
+		std::vector<std::string> names;
+		forms::binders(*n.left, names);
+		forms::assigned(*n.right, names);
+		bind(names);
+		ast::rewrite::visit(n);
+		rename = saved;
+	}
+	virtual void visit(const ast::define &n) override {
+		// A function sees only its own locals, not those of <init>.
+		auto saved = rename;
+		rename.clear();
+		forms::definition d;
+		std::vector<std::string> names;
+		if (forms::define(n, &d)) {
+			if (d.params) forms::binders(*d.params, names);
+			forms::assigned(*d.body, names);
+		}
+		bind(names);
+		ast::rewrite::visit(n);
+		rename = saved;
+	}
+	virtual void visit(const ast::macro &n) override {
+		// The rules point into the macro, so it must be the same node.
+		result = ast::share(n);
+	}
+};
+
+class expansion: public ast::rewrite {
+public:
+	expansion(const std::map<std::string, std::vector<rule>> &r,
+			const std::set<const ast::node*> &d, errors &e,
+			expander::statistics &s): rules(r), defs(d), err(e), stats(s) {}
+	using ast::rewrite::visit;
+	virtual void visit(const ast::apply&) override;
+	virtual void visit(const ast::macro&) override;
+private:
+	ast::ptr instantiate(const rule&, const bindings&,
+			const ast::node &args, location);
+	struct memo {
+		const rule *source;
+		ast::ptr args;
+		ast::ptr out;
+		unsigned first; // serial numbers of the names it introduced
+		unsigned last;
+	};
+	const std::map<std::string, std::vector<rule>> &rules;
+	const std::set<const ast::node*> &defs;
+	errors &err;
+	expander::statistics &stats;
+	std::unordered_map<size_t, std::vector<memo>> cache;
+	unsigned serial = 0;
+	unsigned depth = 0;
+};
+
+void expansion::visit(const ast::apply &n) {
+	auto name = dynamic_cast<const ast::identifier*>(n.left.get());
+	auto r = name? rules.find(name->text): rules.end();
+	if (r == rules.end()) {
+		ast::rewrite::visit(n);
+		return;
+	}
+	for (auto &candidate: r->second) {
+		bindings b;
+		if (match(*candidate.pattern, *n.right, b)) {
+			result = instantiate(candidate, b, *n.right, n.origin);
+			return;
+		}
+	}
+	err.report(n.origin, "no rule of macro '" + name->text +
+			"' matches these arguments");
+	make(new ast::null(n.origin));
+}
+
+void expansion::visit(const ast::macro &n) {
+	if (!defs.count(&n)) {
+		err.report(n.origin, "macros must be defined at the top level");
+	}
+	make(new ast::null(n.origin));
+}
+
+ast::ptr expansion::instantiate(const rule &r, const bindings &b,
+		const ast::node &args, location loc) {
+	size_t key = ast::hash(args) ^ std::hash<const void*>()(&r);
+	std::vector<memo> &slot = cache[key];
+	for (auto &m: slot) {
+		if (m.source != &r || !ast::same(*m.args, args)) continue;
+		++stats.reused;
+		refresh copy;
+		copy.cons = cons;
+		copy.first = m.first;
+		copy.last = m.last;
+		copy.offset = serial + 1 - m.first;
+		serial += m.last + 1 - m.first;
+		return copy(*m.out);
+	}
+	if (depth >= expander::depth_limit) {
+		err.report(loc, "macro expansion nests too deeply");
+		return ast::ptr(new ast::null(loc));
+	}
+	++stats.expanded;
+	unsigned first = serial + 1;
+	instance subst;
+	subst.cons = cons;
+	subst.args = &b;
+	for (auto &name: r.inner) {
+		subst.rename[name] = name + "@" + std::to_string(++serial);
+	}
+	ast::ptr out = subst(*r.body);
+	++depth;
+	out = (*this)(*out);
+	--depth;
+	slot.push_back(memo{&r, ast::share(args), out, first, serial});
+	return out;
+}
+
+} // namespace
+
+void expander::process(ast::ptr &&tree) {
+	auto begin = std::chrono::steady_clock::now();
+	std::vector<const ast::node*> program;
+	forms::statements(*tree, program);
+	std::map<std::string, std::vector<rule>> rules;
+	std::set<const ast::node*> defs;
+	for (auto stmt: program) {
+		auto m = dynamic_cast<const ast::macro*>(stmt);
+		if (!m) continue;
+		defs.insert(stmt);
+		auto head = dynamic_cast<const ast::apply*>(m->left.get());
+		auto name = head?
+				dynamic_cast<const ast::identifier*>(head->left.get()):
+				nullptr;
+		if (!name) {
+			err.report(m->origin,
+					"a macro is defined as 'name(pattern) => template'");
+			continue;
+		}
+		rule r;
+		r.pattern = head->right.get();
+		r.body = m->right.get();
+		std::set<std::string> variables;
+		forms::references(*r.pattern, variables);
+		forms::bound(*r.body, r.inner);
+		for (auto &v: variables) {
+			r.inner.erase(v);
+		}
+		rules[name->text].push_back(r);
+		++stats.rules;
+	}
+	stats.before += forms::size(*tree);
+	if (!defs.empty()) {
+		// Other names in templates refer to top-level definitions.
+		std::set<std::string> free;
+		for (auto &r: rules) {
+			for (auto &candidate: r.second) {
+				std::set<std::string> names, variables;
+				forms::references(*candidate.body, names);
+				forms::references(*candidate.pattern, variables);
+				for (auto &name: names) {
+					if (!variables.count(name) &&
+							!candidate.inner.count(name) &&
+							!rules.count(name)) {
+						free.insert(name);
+					}
+				}
+			}
+		}
+		if (!free.empty()) {
+			shelter s;
+			s.cons = cons;
+			s.free = &free;
+			std::vector<std::string> locals;
+			for (auto stmt: program) {
+				if (!dynamic_cast<const ast::define*>(stmt) &&
+						!dynamic_cast<const ast::macro*>(stmt)) {
+					forms::assigned(*stmt, locals);
+				}
+			}
+			s.bind(locals);
+			tree = s(*tree);
+		}
+		expansion x(rules, defs, err, stats);
+		x.cons = cons;
+		tree = x(*tree);
+	}
+	stats.after += forms::size(*tree);
+	std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - begin;
+	stats.seconds += elapsed.count();
+	out.process(std::move(tree));
+}
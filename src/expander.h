@@ -0,0 +1,54 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef EXPANDER_H
+#define EXPANDER_H
+
+#include "ast.h"
+#include "builder.h"
+#include "errors.h"
+#include <stddef.h>
+
+// Expands macros, which are top-level rules of the form
+// 'name(pattern) => template'. A call to the name whose argument tree has the
+// shape of a rule's pattern is replaced by that rule's template, with each
+// pattern variable replaced by the subtree it matched; the rules for a name
+// are tried in the order they appear. In a pattern, a name matches any tree,
+// '_' matches anything without binding it, a literal matches only itself,
+// and any other node matches a node of the same kind whose children match.
+// The result is expanded again, so templates may use other macros.
+//
+// Expansion is hygienic: names which the template itself binds are renamed
+// with a '@' and a serial number, which the lexer can never produce, so they
+// cannot capture names in the arguments. Other names in the template refer
+// to top-level definitions, as they would in a function; locals which share
+// such a name are renamed the same way, so they cannot capture the
+// template's references. An expansion is remembered by its rule and the
+// hash of its argument tree, and a later call with an identical argument
+// tree gets a copy, with fresh names, instead of being expanded again.
+// Given a builder, the nodes it makes are shared with identical ones.
+struct expander: public ast::delegate {
+	expander(ast::delegate &o, errors &e, ast::builder *b = nullptr):
+			out(o), err(e), cons(b) {}
+	virtual void process(ast::ptr&&) override;
+	// Deepest nesting of expansions within expansions.
+	static const unsigned depth_limit = 64;
+	struct statistics {
+		unsigned rules = 0;
+		unsigned expanded = 0; // instantiated from a template
+		unsigned reused = 0; // copied from an identical expansion
+		size_t before = 0; // nodes in the tree as parsed
+		size_t after = 0; // and once expanded
+		double seconds = 0;
+	};
+	statistics stats;
+private:
+	ast::delegate &out;
+	errors &err;
+	ast::builder *cons;
+};
+
+#endif //EXPANDER_H
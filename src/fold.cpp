@@ -0,0 +1,172 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "fold.h"
+#include "rewrite.h"
+#include <limits>
+
+namespace {
+struct folder: public ast::rewrite {
+	folder(constants &k, errors &e): pool(k), err(e) {}
+	using ast::rewrite::visit;
+	virtual void visit(const ast::number&) override;
+	virtual void visit(const ast::string&) override;
+	virtual void visit(const ast::binop&) override;
+	virtual void visit(const ast::conditional&) override;
+private:
+	bool evaluate(const ast::binop&, int64_t l, int64_t r, int64_t *out);
+	static bool operand(const ast::node&, int64_t *out);
+	constants &pool;
+	errors &err;
+};
+} // namespace
+
+void folder::visit(const ast::number &n) {
+	const uint64_t max = std::numeric_limits<int64_t>::max();
+	uint64_t value = 0;
+	for (char c: n.text) {
+		uint64_t digit = c - '0';
+		if (value > (max - digit) / 10) {
+			err.report(n.origin, "number is too large for a 64-bit integer");
+			value = 0;
+			break;
+		}
+		value = value * 10 + digit;
+	}
+	make(new ast::integer(value, n.origin));
+}
+
+void folder::visit(const ast::string &n) {
+	// The lexer includes the delimiting quote characters in the token text.
+	std::string text = n.text;
+	if (text.size() >= 2) {
+		text = text.substr(1, text.size() - 2);
+	}
+	make(new ast::bytes(pool.intern(text), n.origin));
+}
+
+void folder::visit(const ast::binop &n) {
+	ast::ptr left = (*this)(*n.left);
+	ast::ptr right = (*this)(*n.right);
+	int64_t l = 0, r = 0, value = 0;
+	// The parser supplies a null left operand for prefix operators; negation
+	// and complement are the only prefix forms with an arithmetic meaning.
+	bool prefix = dynamic_cast<ast::null*>(left.get()) != nullptr;
+	bool lconst = false;
+	if (prefix && n.id == syntax::sub) {
+		lconst = true;
+		l = 0;
+	} else if (prefix && n.id == syntax::nand_join) {
+		lconst = true;
+		l = -1;
+	} else if (!prefix) {
+		lconst = operand(*left, &l);
+	}
+	bool rconst = operand(*right, &r);
+	if (lconst && rconst && evaluate(n, l, r, &value)) {
+		make(new ast::integer(value, n.origin));
+		return;
+	}
+	// Single-byte strings stand for characters even when the other operand
+	// is not constant, so later stages never have to look inside them.
+	if (lconst && !prefix && !dynamic_cast<ast::integer*>(left.get())) {
+		left.reset(new ast::integer(l, left->origin));
+	}
+	if (rconst && !dynamic_cast<ast::integer*>(right.get())) {
+		right.reset(new ast::integer(r, right->origin));
+	}
+	if (left.get() == n.left.get() && right.get() == n.right.get()) {
+		result = ast::share(n);
+		return;
+	}
+	make(new ast::binop(
+			n.id, n.text, std::move(left), std::move(right), n.origin));
+}
+
+void folder::visit(const ast::conditional &n) {
+	ast::ptr test = (*this)(*n.test);
+	if (auto i = dynamic_cast<ast::integer*>(test.get())) {
+		result = (*this)(i->value? *n.consequent: *n.alternative);
+		return;
+	}
+	ast::ptr consequent = (*this)(*n.consequent);
+	ast::ptr alternative = (*this)(*n.alternative);
+	if (test.get() == n.test.get() &&
+			consequent.get() == n.consequent.get() &&
+			alternative.get() == n.alternative.get()) {
+		result = ast::share(n);
+		return;
+	}
+	make(new ast::conditional(std::move(test),
+			std::move(consequent), std::move(alternative), n.origin));
+}
+
+bool folder::operand(const ast::node &n, int64_t *out) {
+	if (auto i = dynamic_cast<const ast::integer*>(&n)) {
+		*out = i->value;
+		return true;
+	}
+	if (auto b = dynamic_cast<const ast::bytes*>(&n)) {
+		if (b->value->size() == 1) {
+			*out = static_cast<unsigned char>(b->value->front());
+			return true;
+		}
+	}
+	return false;
+}
+
+bool folder::evaluate(const ast::binop &n, int64_t l, int64_t r, int64_t *v) {
+	bool overflow = false;
+	switch (n.id) {
+		case syntax::and_join: *v = l & r; break;
+		case syntax::or_join: *v = l | r; break;
+		case syntax::xor_join: *v = l ^ r; break;
+		case syntax::nand_join: *v = ~(l & r); break;
+		case syntax::nor_join: *v = ~(l | r); break;
+		case syntax::xnor_join: *v = ~(l ^ r); break;
+		case syntax::add: overflow = __builtin_add_overflow(l, r, v); break;
+		case syntax::sub: overflow = __builtin_sub_overflow(l, r, v); break;
+		case syntax::mul: overflow = __builtin_mul_overflow(l, r, v); break;
+		case syntax::div:
+		case syntax::rem:
+			if (r == 0) {
+				err.report(n.origin, "division by zero in constant expression");
+				return false;
+			}
+			if (l == std::numeric_limits<int64_t>::min() && r == -1) {
+				overflow = true;
+				break;
+			}
+			*v = (n.id == syntax::div)? l / r: l % r;
+			break;
+		case syntax::shl:
+		case syntax::shr:
+			if (r < 0 || r > 63) {
+				err.report(n.origin, "shift count out of range");
+				return false;
+			}
+			*v = (n.id == syntax::shl)? int64_t(uint64_t(l) << r): l >> r;
+			break;
+		case syntax::eq: *v = -(l == r); break;
+		case syntax::gt: *v = -(l > r); break;
+		case syntax::lt: *v = -(l < r); break;
+		case syntax::neq: *v = -(l != r); break;
+		case syntax::ngt: *v = -(l <= r); break;
+		case syntax::nlt: *v = -(l >= r); break;
+		default: return false;
+	}
+	if (overflow) {
+		err.report(n.origin, "constant expression overflows 64 bits");
+		return false;
+	}
+	return true;
+}
+
+void fold::process(ast::ptr &&tree) {
+	folder f(pool, err);
+	f.cons = cons;
+	out.process(f(*tree));
+}
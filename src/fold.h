@@ -0,0 +1,32 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef FOLD_H
+#define FOLD_H
+
+#include "ast.h"
+#include "builder.h"
+#include "constants.h"
+#include "errors.h"
+
+// Decodes number and string literals, then evaluates every operator whose
+// operands are constant. Numbers become 64-bit integers; strings are stripped
+// of their quotes and interned in the constant pool. A string of exactly one
+// byte used as an operand stands for that byte's value. Comparisons yield -1
+// for true and 0 for false, so the bitwise joins double as logical operators.
+// Given a builder, the nodes it makes are shared with identical ones.
+struct fold: public ast::delegate {
+	fold(ast::delegate &o, constants &k, errors &e, ast::builder *b = nullptr):
+			out(o), pool(k), err(e), cons(b) {}
+	virtual void process(ast::ptr&&) override;
+private:
+	ast::delegate &out;
+	constants &pool;
+	errors &err;
+	ast::builder *cons;
+};
+
+#endif //FOLD_H
@@ -0,0 +1,169 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "forms.h"
+
+using namespace forms;
+
+void forms::statements(
+		const ast::node &n, std::vector<const ast::node*> &out) {
+	if (auto s = dynamic_cast<const ast::sequence*>(&n)) {
+		statements(*s->left, out);
+		statements(*s->right, out);
+	} else if (!dynamic_cast<const ast::null*>(&n)) {
+		out.push_back(&n);
+	}
+}
+
+void forms::elements(const ast::node &n, std::vector<const ast::node*> &out) {
+	if (auto p = dynamic_cast<const ast::pair*>(&n)) {
+		elements(*p->left, out);
+		elements(*p->right, out);
+	} else if (!dynamic_cast<const ast::null*>(&n)) {
+		out.push_back(&n);
+	}
+}
+
+void forms::children(const ast::node &n, std::vector<const ast::node*> &out) {
+	if (auto b = dynamic_cast<const ast::branch*>(&n)) {
+		out.push_back(b->left.get());
+		out.push_back(b->right.get());
+	} else if (auto c = dynamic_cast<const ast::conditional*>(&n)) {
+		out.push_back(c->test.get());
+		out.push_back(c->consequent.get());
+		out.push_back(c->alternative.get());
+	}
+}
+
+void forms::binders(const ast::node &n, std::vector<std::string> &out) {
+	if (auto i = dynamic_cast<const ast::identifier*>(&n)) {
+		out.push_back(i->text);
+	} else if (auto d = dynamic_cast<const ast::declare*>(&n)) {
+		binders(*d->left, out);
+	} else if (auto p = dynamic_cast<const ast::pair*>(&n)) {
+		binders(*p->left, out);
+		binders(*p->right, out);
+	}
+}
+
+void forms::bound(const ast::node &n, std::set<std::string> &out) {
+	std::vector<std::string> names;
+	definition d;
+	if (dynamic_cast<const ast::assign*>(&n) ||
+			dynamic_cast<const ast::capture*>(&n)) {
+		binders(*static_cast<const ast::branch&>(n).left, names);
+	} else if (define(n, &d) && d.params) {
+		binders(*d.params, names);
+	}
+	out.insert(names.begin(), names.end());
+	std::vector<const ast::node*> subs;
+	children(n, subs);
+	for (auto sub: subs) {
+		bound(*sub, out);
+	}
+}
+
+void forms::assigned(const ast::node &n, std::vector<std::string> &out) {
+	if (dynamic_cast<const ast::capture*>(&n)) return;
+	if (auto a = dynamic_cast<const ast::assign*>(&n)) {
+		binders(*a->left, out);
+	}
+	std::vector<const ast::node*> subs;
+	children(n, subs);
+	for (auto sub: subs) {
+		assigned(*sub, out);
+	}
+}
+
+void forms::references(const ast::node &n, std::set<std::string> &out) {
+	if (auto i = dynamic_cast<const ast::identifier*>(&n)) {
+		out.insert(i->text);
+		return;
+	}
+	if (auto d = dynamic_cast<const ast::declare*>(&n)) {
+		references(*d->left, out);
+		return;
+	}
+	std::vector<const ast::node*> subs;
+	children(n, subs);
+	for (auto sub: subs) {
+		references(*sub, out);
+	}
+}
+
+size_t forms::size(const ast::node &n) {
+	std::vector<const ast::node*> subs;
+	children(n, subs);
+	size_t total = 1;
+	for (auto sub: subs) {
+		total += size(*sub);
+	}
+	return total;
+}
+
+bool forms::define(const ast::node &n, definition *out) {
+	auto d = dynamic_cast<const ast::define*>(&n);
+	if (!d) return false;
+	const ast::node *head = d->left.get();
+	const ast::node *params = nullptr;
+	if (auto a = dynamic_cast<const ast::apply*>(head)) {
+		head = a->left.get();
+		params = a->right.get();
+	}
+	auto name = dynamic_cast<const ast::identifier*>(head);
+	if (!name) return false;
+	out->name = name->text;
+	out->params = params;
+	out->body = d->right.get();
+	return true;
+}
+
+bool forms::parameters(const ast::node &n, std::vector<std::string> &out) {
+	std::vector<const ast::node*> items;
+	elements(n, items);
+	for (auto item: items) {
+		if (auto d = dynamic_cast<const ast::declare*>(item)) {
+			item = d->left.get();
+		}
+		auto i = dynamic_cast<const ast::identifier*>(item);
+		if (!i) return false;
+		out.push_back(i->text);
+	}
+	return true;
+}
+
+bool forms::alternatives(
+		const ast::node &n, std::vector<const ast::capture*> &out) {
+	std::vector<const ast::node*> items;
+	statements(n, items);
+	for (auto item: items) {
+		auto c = dynamic_cast<const ast::capture*>(item);
+		if (!c) {
+			out.clear();
+			return false;
+		}
+		out.push_back(c);
+	}
+	return !out.empty();
+}
+
+void forms::results(const ast::node &n, std::vector<const ast::node*> &out) {
+	if (auto c = dynamic_cast<const ast::conditional*>(&n)) {
+		results(*c->consequent, out);
+		results(*c->alternative, out);
+		return;
+	}
+	std::vector<const ast::capture*> arms;
+	std::vector<const ast::node*> items;
+	if (dynamic_cast<const ast::sequence*>(&n) && !alternatives(n, arms)) {
+		statements(n, items);
+	}
+	if (!items.empty()) {
+		results(*items.back(), out);
+	} else {
+		out.push_back(&n);
+	}
+}
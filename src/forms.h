@@ -0,0 +1,72 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef FORMS_H
+#define FORMS_H
+
+#include "ast.h"
+#include <set>
+#include <string>
+#include <vector>
+
+// Recognizers for the syntactic forms which several passes must agree on.
+// The parser produces only binary trees, so statement lists, argument lists,
+// and definition heads are all encoded in the shape of those trees.
+namespace forms {
+
+// Statements of a sequence, in order, omitting empty statements.
+void statements(const ast::node&, std::vector<const ast::node*>&);
+
+// Elements of a tuple; anything which is not a pair is a one-element tuple
+// and null is the empty tuple.
+void elements(const ast::node&, std::vector<const ast::node*>&);
+
+// Direct children of a node, left to right.
+void children(const ast::node&, std::vector<const ast::node*>&);
+
+// Names bound by a pattern: identifiers, declarations, and tuples of them.
+void binders(const ast::node&, std::vector<std::string>&);
+
+// Every name bound anywhere inside a tree, by parameter lists, assignments,
+// and captures. Definition names are not included.
+void bound(const ast::node&, std::set<std::string>&);
+
+// Names assigned within a function body, which are its locals, not counting
+// those of nested captures.
+void assigned(const ast::node&, std::vector<std::string>&);
+
+// Every identifier referenced as a value, ignoring the type half of each
+// declaration.
+void references(const ast::node&, std::set<std::string>&);
+
+// Number of nodes in a tree.
+size_t size(const ast::node&);
+
+// A definition of the form 'name(params) := body' or 'name := body'. The
+// params pointer is null for value definitions.
+struct definition {
+	std::string name;
+	const ast::node *params = nullptr;
+	const ast::node *body = nullptr;
+};
+bool define(const ast::node&, definition*);
+
+// Parameter names of a function or capture, if every parameter is a plain
+// name, with or without a declared type.
+bool parameters(const ast::node&, std::vector<std::string>&);
+
+// The clauses of a function literal: a capture, or a sequence made up only
+// of captures, as in '{0 -> a; n -> b}'.
+bool alternatives(const ast::node&, std::vector<const ast::capture*>&);
+
+// The expressions whose values a function body returns as they are, found
+// through the last statement of a sequence and both arms of a conditional.
+// A call among them is in tail position.
+void results(const ast::node&, std::vector<const ast::node*>&);
+
+} // namespace forms
+
+#endif //FORMS_H
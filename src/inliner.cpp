@@ -0,0 +1,355 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "inliner.h"
+#include "forms.h"
+#include "rewrite.h"
+#include <map>
+
+namespace {
+
+// A top-level definition which may be copied into its call sites.
+struct callee {
+	std::vector<std::string> params;
+	const ast::node *body;
+	std::set<std::string> globals; // free names the body refers to
+};
+
+// Replaces parameter names with argument expressions and renames every other
+// name bound inside the body, so nothing in the body can capture a name from
+// the call site.
+struct substitution: public ast::rewrite {
+	std::map<std::string, const ast::node*> replace;
+	std::map<std::string, std::string> rename;
+	using ast::rewrite::visit;
+	virtual void visit(const ast::identifier &n) override {
+		auto r = replace.find(n.text);
+		if (r != replace.end()) {
+			result = ast::share(*r->second);
+			return;
+		}
+		auto i = rename.find(n.text);
+		if (i == rename.end()) {
+			result = ast::share(n);
+			return;
+		}
+		make(new ast::identifier(i->second, n.origin));
+	}
+	virtual void visit(const ast::declare &n) override {
+		ast::ptr left = (*this)(*n.left);
+		ast::ptr right = n.right;
+		make(new ast::declare(
+				std::move(left), std::move(right), n.origin));
+	}
+};
+
+// Counts the uses of a name, noting whether any occurs inside a capture,
+// where it might be evaluated many times.
+void uses(const ast::node &n, const std::string &name,
+		bool nested, unsigned *count, bool *captured) {
+	if (auto i = dynamic_cast<const ast::identifier*>(&n)) {
+		if (i->text == name) {
+			++*count;
+			*captured |= nested;
+		}
+		return;
+	}
+	if (auto d = dynamic_cast<const ast::declare*>(&n)) {
+		uses(*d->left, name, nested, count, captured);
+		return;
+	}
+	nested |= dynamic_cast<const ast::capture*>(&n) != nullptr;
+	std::vector<const ast::node*> subs;
+	forms::children(n, subs);
+	for (auto sub: subs) {
+		uses(*sub, name, nested, count, captured);
+	}
+}
+
+// Copying a trivial argument costs nothing at runtime. Captures count, when
+// small, since evaluating one only builds a closure and copying it lets each
+// application be beta-reduced.
+bool trivial(const ast::node &n) {
+	if (dynamic_cast<const ast::capture*>(&n)) {
+		return forms::size(n) <= inliner::body_limit;
+	}
+	return dynamic_cast<const ast::identifier*>(&n) ||
+			dynamic_cast<const ast::integer*>(&n) ||
+			dynamic_cast<const ast::bytes*>(&n) ||
+			dynamic_cast<const ast::null*>(&n);
+}
+
+// Does this expression always produce one of the boolean values -1 or 0?
+bool boolean(const ast::node &n) {
+	if (auto i = dynamic_cast<const ast::integer*>(&n)) {
+		return i->value == 0 || i->value == -1;
+	}
+	if (auto c = dynamic_cast<const ast::conditional*>(&n)) {
+		return boolean(*c->consequent) && boolean(*c->alternative);
+	}
+	auto b = dynamic_cast<const ast::binop*>(&n);
+	if (!b) return false;
+	switch (b->id) {
+		case syntax::eq: case syntax::gt: case syntax::lt:
+		case syntax::neq: case syntax::ngt: case syntax::nlt:
+			return true;
+		case syntax::and_join: case syntax::or_join: case syntax::xor_join:
+		case syntax::nand_join: case syntax::nor_join: case syntax::xnor_join:
+			return (dynamic_cast<const ast::null*>(b->left.get()) ||
+					boolean(*b->left)) && boolean(*b->right);
+		default:
+			return false;
+	}
+}
+
+struct evaluator: public ast::rewrite {
+	evaluator(const std::map<std::string, callee> &c,
+			const std::map<std::string, const ast::node*> &v, size_t b):
+			callees(c), values(v), budget(b) {}
+	using ast::rewrite::visit;
+	virtual void visit(const ast::identifier&) override;
+	virtual void visit(const ast::apply&) override;
+	virtual void visit(const ast::pipe&) override;
+	// names bound within the definition being rewritten
+	std::set<std::string> locals;
+private:
+	ast::ptr expand(const std::vector<std::string> &params,
+			const ast::node &body, ast::ptr &&args, location);
+	const std::map<std::string, callee> &callees;
+	const std::map<std::string, const ast::node*> &values;
+	size_t budget;
+	unsigned depth = 0;
+	unsigned serial = 0;
+};
+
+void evaluator::visit(const ast::identifier &n) {
+	auto v = values.find(n.text);
+	if (v != values.end() && !locals.count(n.text)) {
+		// The constant takes the place, and so the location, of the name.
+		if (auto i = dynamic_cast<const ast::integer*>(v->second)) {
+			make(new ast::integer(i->value, n.origin));
+		} else {
+			auto b = static_cast<const ast::bytes*>(v->second);
+			make(new ast::bytes(b->value, n.origin));
+		}
+		return;
+	}
+	ast::rewrite::visit(n);
+}
+
+void evaluator::visit(const ast::apply &n) {
+	ast::ptr fn = (*this)(*n.left);
+	ast::ptr arg = (*this)(*n.right);
+	std::vector<std::string> params;
+	if (auto c = dynamic_cast<ast::capture*>(fn.get())) {
+		if (forms::parameters(*c->left, params)) {
+			result = expand(params, *c->right, std::move(arg), n.origin);
+			if (result) return;
+		}
+	}
+	if (auto i = dynamic_cast<ast::identifier*>(fn.get())) {
+		auto f = callees.find(i->text);
+		bool shadowed = locals.count(i->text) > 0;
+		if (f != callees.end()) {
+			for (auto &g: f->second.globals) {
+				shadowed |= locals.count(g) > 0;
+			}
+		}
+		if (f != callees.end() && !shadowed) {
+			const callee &target = f->second;
+			result = expand(target.params, *target.body,
+					std::move(arg), n.origin);
+			if (result) return;
+		}
+	}
+	auto alternatives = dynamic_cast<ast::pair*>(arg.get());
+	if (alternatives && boolean(*fn)) {
+		make(new ast::conditional(std::move(fn),
+				ast::ptr(alternatives->left),
+				ast::ptr(alternatives->right), n.origin));
+		return;
+	}
+	if (fn.get() == n.left.get() && arg.get() == n.right.get()) {
+		result = ast::share(n);
+		return;
+	}
+	make(new ast::apply(std::move(fn), std::move(arg), n.origin));
+}
+
+void evaluator::visit(const ast::pipe &n) {
+	// 'x . f' means 'f(x)'; normalizing it lets a pipe into a capture be
+	// beta-reduced, so the stages on either side can fuse into one loop.
+	ast::ptr normal(new ast::apply(
+			ast::ptr(n.right), ast::ptr(n.left), n.origin));
+	visit(static_cast<const ast::apply&>(*normal));
+}
+
+ast::ptr evaluator::expand(const std::vector<std::string> &params,
+		const ast::node &body, ast::ptr &&args, location loc) {
+	// The caller retains ownership of the arguments unless we succeed.
+	std::vector<const ast::node*> items;
+	forms::elements(*args, items);
+	size_t cost = forms::size(body);
+	if (items.size() != params.size() || cost > budget ||
+			depth > inliner::depth_limit) {
+		return nullptr;
+	}
+	std::set<std::string> inner;
+	forms::bound(body, inner);
+	for (auto &p: params) {
+		if (inner.count(p)) return nullptr;
+	}
+	budget -= cost;
+
+	substitution subst;
+	subst.cons = cons;
+	for (auto &name: inner) {
+		subst.rename[name] = name + "#" + std::to_string(++serial);
+	}
+	// An argument is copied into the body when that cannot change how often
+	// it is evaluated; otherwise it is bound once to a fresh local.
+	std::vector<ast::ptr> lets;
+	std::vector<ast::ptr> temps;
+	for (size_t i = 0; i < params.size(); ++i) {
+		unsigned count = 0;
+		bool captured = false;
+		uses(body, params[i], false, &count, &captured);
+		if (count == 0) continue;
+		if (trivial(*items[i]) || (count == 1 && !captured)) {
+			subst.replace[params[i]] = items[i];
+			continue;
+		}
+		std::string temp = params[i] + "#" + std::to_string(++serial);
+		temps.emplace_back(new ast::identifier(temp, loc));
+		subst.replace[params[i]] = temps.back().get();
+		lets.emplace_back(new ast::assign(
+				ast::ptr(new ast::identifier(temp, loc)),
+				ast::share(*items[i]), loc));
+	}
+	ast::ptr out = subst(body);
+	while (!lets.empty()) {
+		out.reset(new ast::sequence(
+				std::move(lets.back()), std::move(out), loc));
+		lets.pop_back();
+	}
+	// Substitution may expose more work, such as a parameter which was
+	// applied as a function and is now bound to a known capture.
+	++depth;
+	out = (*this)(*out);
+	--depth;
+	return out;
+}
+
+} // namespace
+
+void inliner::process(ast::ptr &&tree) {
+	std::vector<const ast::node*> program;
+	forms::statements(*tree, program);
+
+	// Find the definitions and how they refer to each other.
+	std::map<std::string, forms::definition> defs;
+	std::map<std::string, unsigned> counts;
+	for (auto stmt: program) {
+		forms::definition d;
+		if (forms::define(*stmt, &d)) {
+			defs[d.name] = d;
+			counts[d.name]++;
+		}
+	}
+	std::map<std::string, std::set<std::string>> refs;
+	for (auto &d: defs) {
+		std::set<std::string> names, locals;
+		forms::references(*d.second.body, names);
+		forms::bound(*d.second.body, locals);
+		if (d.second.params) {
+			forms::bound(*d.second.params, locals);
+			std::vector<std::string> params;
+			forms::binders(*d.second.params, params);
+			locals.insert(params.begin(), params.end());
+		}
+		for (auto &name: names) {
+			if (defs.count(name) && !locals.count(name)) {
+				refs[d.first].insert(name);
+			}
+		}
+	}
+
+	// Select the definitions which are small, unique, and cannot reach
+	// themselves through the reference graph.
+	std::map<std::string, callee> callees;
+	std::map<std::string, const ast::node*> values;
+	for (auto &d: defs) {
+		if (counts[d.first] != 1) continue;
+		std::set<std::string> seen;
+		std::vector<std::string> work(
+				refs[d.first].begin(), refs[d.first].end());
+		bool recursive = false;
+		while (!work.empty() && !recursive) {
+			std::string next = work.back();
+			work.pop_back();
+			recursive = (next == d.first);
+			if (!seen.insert(next).second) continue;
+			work.insert(work.end(), refs[next].begin(), refs[next].end());
+		}
+		if (recursive) continue;
+		const ast::node *body = d.second.body;
+		const ast::node *params = d.second.params;
+		if (!params) {
+			if (auto c = dynamic_cast<const ast::capture*>(body)) {
+				params = c->left.get();
+				body = c->right.get();
+			} else if (dynamic_cast<const ast::integer*>(body) ||
+					dynamic_cast<const ast::bytes*>(body)) {
+				values[d.first] = body;
+				continue;
+			} else {
+				continue;
+			}
+		}
+		callee target;
+		if (!forms::parameters(*params, target.params)) continue;
+		if (forms::size(*body) > body_limit) continue;
+		target.body = body;
+		std::set<std::string> names, inner;
+		forms::references(*body, names);
+		forms::bound(*body, inner);
+		for (auto &name: names) {
+			bool param = false;
+			for (auto &p: target.params) param |= (p == name);
+			if (!param && !inner.count(name)) target.globals.insert(name);
+		}
+		callees[d.first] = target;
+	}
+
+	// Rewrite each statement, keeping track of the names it binds so that
+	// a local never gets confused with a global of the same name.
+	evaluator e(callees, values, forms::size(*tree) * growth_factor);
+	e.cons = cons;
+	ast::ptr result;
+	for (auto stmt: program) {
+		e.locals.clear();
+		forms::bound(*stmt, e.locals);
+		ast::ptr next;
+		forms::definition d;
+		if (forms::define(*stmt, &d)) {
+			auto def = static_cast<const ast::define*>(stmt);
+			next.reset(new ast::define(ast::share(*def->left),
+					e(*def->right), def->origin));
+		} else {
+			next = e(*stmt);
+		}
+		if (result) {
+			location loc = result->origin + next->origin;
+			next.reset(new ast::sequence(
+					std::move(result), std::move(next), loc));
+		}
+		result = std::move(next);
+	}
+	if (!result) {
+		result = std::move(tree);
+	}
+	out.process(std::move(result));
+}
@@ -0,0 +1,37 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef INLINER_H
+#define INLINER_H
+
+#include "ast.h"
+#include "builder.h"
+
+// Partial evaluator. Calls to small, non-recursive top-level definitions are
+// replaced by the callee's body, applications of literal captures are beta-
+// reduced, and constant value definitions are propagated to their uses.
+// Applying a boolean-valued expression to a pair selects one alternative, so
+// such applications become conditionals which evaluate only the chosen arm;
+// this is what turns Church-encoded selectors like 'islower(c)(a, b)' into a
+// compare and branch. Inlined parameters and locals are given fresh names
+// containing '#', which the lexer can never produce. Given a builder, the
+// nodes it makes are shared with identical ones.
+struct inliner: public ast::delegate {
+	explicit inliner(ast::delegate &o, ast::builder *b = nullptr):
+			out(o), cons(b) {}
+	virtual void process(ast::ptr&&) override;
+	// Largest body, in nodes, which will be copied into a call site.
+	static const size_t body_limit = 32;
+	// Total growth allowed per tree, as a multiple of its original size.
+	static const size_t growth_factor = 2;
+	// Deepest nesting of inlined bodies within inlined bodies.
+	static const unsigned depth_limit = 32;
+private:
+	ast::delegate &out;
+	ast::builder *cons;
+};
+
+#endif //INLINER_H
@@ -72,12 +72,12 @@ retry:
 			case DELIM: buf << c; emit(token::delimiter); break;
 			case '\n': tk_end = tk_end.next_row(); clear(); break;
 			case SPACE: state = space; break;
-			case '\0': break;
+			case '\0': emit(token::eof); break;
 			default: reject(c); break;
 		} break;
 
 		case comment: switch (c) {
-			case '\n': clear(); goto retry;
+			case '\n': case '\0': clear(); goto retry;
 			default: break;
 		} break;
 
@@ -88,6 +88,7 @@ retry:
 
 		case string: switch (c) {
 			case '\"': buf << c; emit(token::string); break;
+			case '\0': reject(c); goto retry;
 			default: buf << c; break;
 		} break;
 
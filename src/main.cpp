@@ -4,56 +4,558 @@
 // this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
 // IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
 
-#include <iostream>
+#include <chrono>
+#include <errno.h>
 #include <fstream>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <stack>
 
+#include "bytecode.h"
+#include "cgen.h"
+#include "channel.h"
+#include "compiler.h"
+#include "constants.h"
+#include "errors.h"
+#include "escape.h"
+#include "expander.h"
+#include "fold.h"
+#include "inliner.h"
 #include "lexer.h"
 #include "parser.h"
+#include "poller.h"
+#include "printer.h"
+#include "profiler.h"
+#include "scheduler.h"
+#include "server.h"
+#include "stream.h"
 #include "treegen.h"
-#include "errors.h"
+#include "vm.h"
 
 using std::string;
 
-struct dummy: public ast::delegate {
-	virtual void process(ast::unique_ptr &&n) {}
-	void print() {}
+typedef runtime::source input;
+
+// Whether the tree builder shares repeated subtrees; see -share.
+static bool sharing = false;
+
+// What the front end did, for -stats.
+struct summary {
+	expander::statistics macros;
+	size_t built = 0; // distinct tree nodes, when sharing
+	size_t shared = 0;
 };
 
-static int run(std::istream &i) {
-	errors e;
-	dummy o;
-	treegen t(o, e);
+static bool parse(input &i, ast::delegate &o, constants &k, errors &e,
+		summary *stats = nullptr) {
+	// With sharing, every pass builds its nodes through the same table, so
+	// subtrees which are alike stay shared on the way to the compiler.
+	ast::builder cons;
+	ast::builder *b = sharing? &cons: nullptr;
+	fold g(o, k, e, b);
+	inliner n(g, b);
+	fold f(n, k, e, b);
+	expander x(f, e, b);
+	treegen t(x, e, b);
 	parser p(t, e);
 	lexer l(p, e);
-	char c;
-	while (i.get(c)) {
-		l.scan(c);
+	const uint8_t *data;
+	while (size_t n = i.next(&data)) {
+		for (size_t c = 0; c < n; ++c) {
+			l.scan(data[c]);
+		}
 	}
 	l.scan(0);
-	o.print();
-	return 0;
+	if (stats) {
+		stats->macros = x.stats;
+		stats->built = cons.built;
+		stats->shared = cons.shared;
+	}
+	if (i.failed()) {
+		std::cerr << "read failed: " << strerror(i.error) << std::endl;
+		return false;
+	}
+	return !e.any();
+}
+
+// Opens a program file, or explains why it could not.
+static std::unique_ptr<input> load(const char *path) {
+	std::unique_ptr<input> out = runtime::open_source(path);
+	if (!out) {
+		std::cerr << path << ": " << strerror(errno) << std::endl;
+	}
+	return out;
+}
+
+static int run(input &i) {
+	errors e;
+	constants k;
+	printer o(std::cout);
+	return parse(i, o, k, e)? EXIT_SUCCESS: EXIT_FAILURE;
+}
+
+static int disassemble(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	bytecode::disassemble(prog, std::cout);
+	return EXIT_SUCCESS;
+}
+
+// Lists every allocation site, saying which can live in the region of the
+// call which made them and why the others escape it.
+static int escapes(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	std::vector<escape::site> sites;
+	escape::analyze(prog, &sites);
+	for (auto &s: sites) {
+		std::cout << escape::describe(prog, s) << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Compiles a program to warn of every recursive call which is not in tail
+// position, since only those take a stack frame for each level.
+static int recursion(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	c.recursion = true;
+	return parse(i, c, k, e)? EXIT_SUCCESS: EXIT_FAILURE;
+}
+
+// Reports how many tree nodes were shared, what macro expansion cost and how
+// much code it produced, and the size of the resulting bytecode.
+static int statistics(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	summary sum;
+	if (!parse(i, c, k, e, &sum)) return EXIT_FAILURE;
+	if (sharing) {
+		std::cout << "tree: " << sum.built << " nodes built, ";
+		std::cout << sum.shared << " shared" << std::endl;
+	}
+	expander::statistics &s = sum.macros;
+	std::cout << "macros: " << s.rules << " rules, " << s.expanded;
+	std::cout << " expanded, " << s.reused << " reused" << std::endl;
+	std::cout << "expansion: " << s.seconds * 1e3 << " ms, " << s.before;
+	std::cout << " nodes in, " << s.after << " out" << std::endl;
+	size_t code = 0;
+	for (auto &f: prog.functions) {
+		code += f.code.size();
+	}
+	std::cout << "bytecode: " << prog.functions.size() << " functions, ";
+	std::cout << code << " instructions" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+static int translate(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	cgen(std::cout).generate(prog);
+	return EXIT_SUCCESS;
+}
+
+static int launch(vm::machine &m, const bytecode::program &prog) {
+	vm::value result;
+	if (!m.start(&result)) return EXIT_FAILURE;
+	if (prog.main >= 0) {
+		// A program defining 'main' is a filter from stdin to stdout.
+		std::string in;
+		std::unique_ptr<input> stdin_source = runtime::fd_source(0);
+		const uint8_t *data;
+		while (size_t n = stdin_source->next(&data)) {
+			in.append(reinterpret_cast<const char*>(data), n);
+		}
+		if (stdin_source->failed()) {
+			std::cerr << "stdin: " << strerror(stdin_source->error);
+			std::cerr << std::endl;
+			return EXIT_FAILURE;
+		}
+		vm::blob *b = m.memory.make_blob(in.size());
+		memcpy(b->data, in.data(), in.size());
+		if (m.profile) {
+			// Time spent reading is not the program's.
+			m.profile->discard();
+		}
+		vm::value arg(b), fn;
+		m.global("main", &fn);
+		if (!m.call(fn, &arg, 1, &result)) return EXIT_FAILURE;
+		if (result.type != vm::kind::blob) {
+			vm::write(std::cout, prog, result);
+			return EXIT_SUCCESS;
+		}
+		// Byte arrays go out directly, skipping the iostream buffer.
+		std::cout.flush();
+		runtime::sink out(1);
+		if (!out.write(result.b->data, result.b->length) || !out.flush()) {
+			std::cerr << "stdout: " << strerror(out.error) << std::endl;
+			return EXIT_FAILURE;
+		}
+	} else if (result.type != vm::kind::nil) {
+		vm::write(std::cout, prog, result);
+		std::cout << std::endl;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int execute(input &i) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	vm::machine m(prog, e);
+	return launch(m, prog);
+}
+
+// Runs a program as 'run' does, then reports where it spent its time on
+// stderr; given a path, it also writes the stacks there for a flame graph.
+static int profile(input &i, vm::profiler::mode how, const char *stacks) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	vm::machine m(prog, e);
+	vm::profiler p(prog, how);
+	m.profile = &p;
+	int status = launch(m, prog);
+	p.stop();
+	std::cout.flush();
+	p.report(std::cerr);
+	if (!stacks) return status;
+	std::ofstream folded(stacks);
+	p.folded(folded);
+	folded.close();
+	if (!folded) {
+		std::cerr << stacks << ": " << strerror(errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+	return status;
+}
+
+// Times 'main' over a generated buffer of printable text, once with the
+// scalar loops and once with vector kernels, and checks they agree.
+static int benchmark(input &i, size_t megabytes) {
+	errors e;
+	constants k;
+	bytecode::program prog;
+	compiler c(prog, e);
+	if (!parse(i, c, k, e)) return EXIT_FAILURE;
+	if (prog.main < 0) {
+		std::cerr << "benchmark needs a main function" << std::endl;
+		return EXIT_FAILURE;
+	}
+	uint64_t sums[2];
+	for (int vectorize = 0; vectorize < 2; ++vectorize) {
+		vm::machine m(prog, e);
+		m.vectorize = vectorize;
+		vm::value result, fn;
+		if (!m.start(&result) || !m.global("main", &fn)) return EXIT_FAILURE;
+		vm::blob *b = m.memory.make_blob(megabytes << 20);
+		uint64_t seed = 88172645463325252ULL;
+		for (size_t n = 0; n < b->length; ++n) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			b->data[n] = ' ' + seed % 95;
+		}
+		vm::value arg(b);
+		auto begin = std::chrono::steady_clock::now();
+		if (!m.call(fn, &arg, 1, &result)) return EXIT_FAILURE;
+		std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - begin;
+		// FNV-1a over the output, if it is a byte array.
+		uint64_t sum = 14695981039346656037ULL;
+		if (result.type == vm::kind::blob) {
+			for (size_t n = 0; n < result.b->length; ++n) {
+				sum = (sum ^ result.b->data[n]) * 1099511628211ULL;
+			}
+		}
+		sums[vectorize] = sum;
+		std::cout << (vectorize? "vector": "scalar") << ": ";
+		std::cout << elapsed.count() << " s, ";
+		std::cout << megabytes / elapsed.count() << " MiB/s" << std::endl;
+	}
+	if (sums[0] != sums[1]) {
+		std::cerr << "vector and scalar results differ" << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+namespace {
+
+// Bytes each process of the chain benchmark moves before giving others a
+// turn, should it never block.
+const size_t quantum = 1 << 20;
+
+class source: public runtime::process {
+public:
+	source(runtime::channel &o, size_t bytes): out(o), left(bytes) {}
+	status run() override {
+		for (size_t moved = 0; left; ) {
+			uint8_t *dst;
+			size_t n = std::min(out.writable(&dst), left);
+			if (!n) return status::blocked;
+			memset(dst, 'x', n);
+			out.commit(n);
+			left -= n;
+			if ((moved += n) >= quantum) return status::yield;
+		}
+		out.close();
+		return status::done;
+	}
+private:
+	runtime::channel &out;
+	size_t left;
+};
+
+class relay: public runtime::process {
+public:
+	relay(runtime::channel &i, runtime::channel &o): in(i), out(o) {}
+	status run() override {
+		for (size_t moved = 0; moved < quantum; ) {
+			const uint8_t *src;
+			size_t n = in.readable(&src);
+			if (!n) {
+				if (!in.finished()) return status::blocked;
+				out.close();
+				return status::done;
+			}
+			uint8_t *dst;
+			n = std::min(n, out.writable(&dst));
+			if (!n) return status::blocked;
+			memcpy(dst, src, n);
+			out.commit(n);
+			in.consume(n);
+			moved += n;
+		}
+		return status::yield;
+	}
+private:
+	runtime::channel &in;
+	runtime::channel &out;
+};
+
+class sink: public runtime::process {
+public:
+	explicit sink(runtime::channel &i): in(i) {}
+	status run() override {
+		for (size_t moved = 0; moved < quantum; ) {
+			const uint8_t *src;
+			size_t n = in.readable(&src);
+			if (!n) return in.finished()? status::done: status::blocked;
+			for (size_t k = 0; k < n; ++k) {
+				bad += src[k] != 'x';
+			}
+			in.consume(n);
+			total += n;
+			moved += n;
+		}
+		return status::yield;
+	}
+	size_t total = 0;
+	size_t bad = 0;
+private:
+	runtime::channel &in;
+};
+
+} // namespace
+
+// Streams bytes through a chain of pass-through processes, each connected
+// to the next by a channel, and reports the throughput.
+static int chain(unsigned length, size_t megabytes, unsigned workers) {
+	size_t bytes = megabytes << 20;
+	std::vector<std::unique_ptr<runtime::channel>> links;
+	for (unsigned i = 0; i <= length; ++i) {
+		links.emplace_back(new runtime::channel);
+	}
+	std::vector<std::unique_ptr<runtime::process>> procs;
+	procs.emplace_back(new source(*links.front(), bytes));
+	for (unsigned i = 0; i < length; ++i) {
+		procs.emplace_back(new relay(*links[i], *links[i + 1]));
+	}
+	sink *end = new sink(*links.back());
+	procs.emplace_back(end);
+	for (unsigned i = 0; i <= length; ++i) {
+		links[i]->attach(procs[i].get(), procs[i + 1].get());
+	}
+	runtime::scheduler s(workers);
+	for (auto &p: procs) {
+		s.spawn(p.get());
+	}
+	auto begin = std::chrono::steady_clock::now();
+	s.run();
+	std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - begin;
+	if (end->total != bytes || end->bad) {
+		std::cerr << "chain delivered " << end->total << " bytes, ";
+		std::cerr << end->bad << " wrong, of " << bytes << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::cout << length << " relays, " << s.workers() << " workers: ";
+	std::cout << elapsed.count() << " s, ";
+	std::cout << megabytes / elapsed.count() << " MiB/s" << std::endl;
+	return EXIT_SUCCESS;
+}
+
+// Copies stdin to stdout through a chain of relays, with the descriptors
+// serviced by the poller; with no relays, the kernel moves the bytes itself.
+static int forward(unsigned length, unsigned workers) {
+	if (!length) {
+		if (runtime::transfer(0, 1)) return EXIT_SUCCESS;
+		std::cerr << "forward: " << strerror(errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::vector<std::unique_ptr<runtime::channel>> links;
+	for (unsigned i = 0; i <= length; ++i) {
+		links.emplace_back(new runtime::channel);
+	}
+	// The endpoints tell the poller to forget their descriptors as they go,
+	// so it must outlive them.
+	runtime::poller events;
+	std::vector<std::unique_ptr<runtime::process>> procs;
+	runtime::scheduler s(workers);
+	runtime::input *head = new runtime::input(events, 0, *links.front());
+	procs.emplace_back(head);
+	for (unsigned i = 0; i < length; ++i) {
+		procs.emplace_back(new relay(*links[i], *links[i + 1]));
+	}
+	runtime::output *tail = new runtime::output(events, 1, *links.back());
+	procs.emplace_back(tail);
+	for (unsigned i = 0; i <= length; ++i) {
+		links[i]->attach(procs[i].get(), procs[i + 1].get());
+	}
+	for (auto &p: procs) {
+		s.spawn(p.get());
+	}
+	s.run();
+	if (head->error || tail->error) {
+		int error = head->error? head->error: tail->error;
+		std::cerr << "forward: " << strerror(error) << std::endl;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
 }
 
+// Stays running, keeping compiled programs for clients; see server.h.
+static int serve() {
+	auto front = [](input &i, server::module &m, errors &e) {
+		compiler c(m.prog, e);
+		return parse(i, c, m.pool, e);
+	};
+	return server::serve(server::default_socket(), front);
+}
+
+// Usage:
+//	rfl [-share] run file
+//	rfl [-share] -profile file [stacks]
+//	rfl [-share] -instrument file [stacks]
+//	rfl [-share] -emit-c | -escape | -Wrecursion | -stats | -S file
+//	rfl [-share] bench file [megabytes]
+//	rfl chain length [megabytes [workers]] | pipe length [workers]
+//	rfl --daemon | --client command file
+//	rfl [-share] [file ...]
+// -profile samples and -instrument counts; both print a flat profile on
+// stderr, and write folded stacks for a flame graph to 'stacks' if given.
+// With no file, rfl reads a program from stdin, or a line at a time from a
+// terminal.
 int main(int argc, const char *argv[]) {
+	// Sharing is optional, since a shared node keeps the location of its
+	// first occurrence, which may make messages point at the wrong place.
+	if (argc > 1 && !strcmp(argv[1], "-share")) {
+		sharing = true;
+		--argc;
+		++argv;
+	}
+	if (argc == 2 && !strcmp(argv[1], "--daemon")) {
+		return serve();
+	}
+	if (argc == 4 && !strcmp(argv[1], "--client")) {
+		if (!server::known(argv[2])) {
+			std::cerr << "unknown command: " << argv[2] << std::endl;
+			return EXIT_FAILURE;
+		}
+		return server::request(server::default_socket(), argv[2], argv[3]);
+	}
+	if (argc == 3 && !strcmp(argv[1], "run")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? execute(*file): EXIT_FAILURE;
+	}
+	if ((argc == 3 || argc == 4) && (!strcmp(argv[1], "-profile") ||
+			!strcmp(argv[1], "-instrument"))) {
+		std::unique_ptr<input> file = load(argv[2]);
+		if (!file) return EXIT_FAILURE;
+		auto how = strcmp(argv[1], "-profile")?
+				vm::profiler::mode::instrument: vm::profiler::mode::sample;
+		return profile(*file, how, argc == 4? argv[3]: nullptr);
+	}
+	if (argc == 3 && !strcmp(argv[1], "-emit-c")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? translate(*file): EXIT_FAILURE;
+	}
+	if (argc == 3 && !strcmp(argv[1], "-escape")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? escapes(*file): EXIT_FAILURE;
+	}
+	if (argc == 3 && !strcmp(argv[1], "-Wrecursion")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? recursion(*file): EXIT_FAILURE;
+	}
+	if (argc == 3 && !strcmp(argv[1], "-stats")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? statistics(*file): EXIT_FAILURE;
+	}
+	if (argc == 3 && !strcmp(argv[1], "-S")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		return file? disassemble(*file): EXIT_FAILURE;
+	}
+	if ((argc == 3 || argc == 4) && !strcmp(argv[1], "bench")) {
+		std::unique_ptr<input> file = load(argv[2]);
+		if (!file) return EXIT_FAILURE;
+		return benchmark(*file, argc == 4? strtoul(argv[3], nullptr, 10): 1024);
+	}
+	if (argc >= 3 && argc <= 5 && !strcmp(argv[1], "chain")) {
+		return chain(strtoul(argv[2], nullptr, 10),
+				argc >= 4? strtoul(argv[3], nullptr, 10): 1024,
+				argc >= 5? strtoul(argv[4], nullptr, 10): 0);
+	}
+	if ((argc == 3 || argc == 4) && !strcmp(argv[1], "pipe")) {
+		return forward(strtoul(argv[2], nullptr, 10),
+				argc == 4? strtoul(argv[3], nullptr, 10): 0);
+	}
 	if (argc <= 1 && isatty(fileno(stdin))) {
 		std::cout << "$> ";
 		for (std::string line; std::getline(std::cin, line);) {
-			std::stringstream in(line);
-			run(in);
+			run(*runtime::string_source(line));
 			std::cout << std::endl << "$> ";
 		}
 		return EXIT_SUCCESS;
 	}
 	if (argc <= 1) {
-		return run(std::cin);
+		return run(*runtime::fd_source(0));
 	}
 	for (int i = 1; i < argc; ++i) {
-		std::ifstream file(argv[i]);
-		int ret = run(file);
+		std::unique_ptr<input> file = load(argv[i]);
+		if (!file) return EXIT_FAILURE;
+		int ret = run(*file);
 		if (ret) return ret;
 	}
 	return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,240 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "match.h"
+#include "forms.h"
+#include <map>
+#include <set>
+
+using namespace match;
+typedef pattern::kind kind;
+
+namespace {
+
+bool same(const pattern &a, const pattern &b) {
+	if (a.type != b.type) return false;
+	return a.type == kind::integer? a.integer == b.integer: a.bytes == b.bytes;
+}
+
+std::string show(const pattern &p) {
+	switch (p.type) {
+		case kind::any: return "_";
+		case kind::integer: return std::to_string(p.integer);
+		case kind::bytes: return "\"" + *p.bytes + "\"";
+	}
+	return "_";
+}
+
+// Builds the tree from the top down. A subproblem is fully described by the
+// clauses still in the running and the arguments not yet tested, so equal
+// subproblems are built once and shared.
+class builder {
+public:
+	builder(const std::vector<clause> &c, tree &t): clauses(c), out(t) {}
+	unsigned build(const std::vector<unsigned> &rows,
+			const std::vector<bool> &untested);
+	std::vector<bool> used;
+private:
+	unsigned choose(const std::vector<unsigned> &rows,
+			const std::vector<bool> &untested);
+	const std::vector<clause> &clauses;
+	tree &out;
+	typedef std::pair<std::vector<unsigned>, std::vector<bool>> problem;
+	std::map<problem, unsigned> memo;
+};
+
+unsigned builder::choose(const std::vector<unsigned> &rows,
+		const std::vector<bool> &untested) {
+	// Only arguments the first clause tests are worth testing now, since
+	// nothing can be decided without them. Of those, prefer the one the
+	// most clauses in a row depend on, then the one with fewest cases.
+	unsigned best = 0, best_needed = 0, best_cases = 0;
+	for (unsigned col = 0; col < untested.size(); ++col) {
+		if (!untested[col]) continue;
+		if (clauses[rows[0]].patterns[col].type == kind::any) continue;
+		unsigned needed = 0;
+		while (needed < rows.size() &&
+				clauses[rows[needed]].patterns[col].type != kind::any) {
+			++needed;
+		}
+		std::vector<const pattern*> seen;
+		for (unsigned r: rows) {
+			const pattern &p = clauses[r].patterns[col];
+			if (p.type == kind::any) continue;
+			bool found = false;
+			for (auto s: seen) found |= same(*s, p);
+			if (!found) seen.push_back(&p);
+		}
+		unsigned cases = seen.size();
+		if (!best_needed || needed > best_needed ||
+				(needed == best_needed && cases < best_cases)) {
+			best = col;
+			best_needed = needed;
+			best_cases = cases;
+		}
+	}
+	return best;
+}
+
+unsigned builder::build(const std::vector<unsigned> &rows,
+		const std::vector<bool> &untested) {
+	problem key(rows, untested);
+	auto found = memo.find(key);
+	if (found != memo.end()) return found->second;
+	decision d;
+	bool decided = rows.empty();
+	if (!decided) {
+		decided = true;
+		for (unsigned col = 0; col < untested.size(); ++col) {
+			if (!untested[col]) continue;
+			decided &= clauses[rows[0]].patterns[col].type == kind::any;
+		}
+	}
+	if (decided && !rows.empty()) {
+		d.type = decision::kind::leaf;
+		d.clause = rows[0];
+		used[rows[0]] = true;
+	} else if (!decided) {
+		d.type = decision::kind::test;
+		d.column = choose(rows, untested);
+		std::vector<bool> rest = untested;
+		rest[d.column] = false;
+		std::vector<unsigned> others;
+		for (unsigned r: rows) {
+			const pattern &p = clauses[r].patterns[d.column];
+			if (p.type == kind::any) {
+				others.push_back(r);
+				continue;
+			}
+			bool seen = false;
+			for (auto &e: d.cases) {
+				if (!same(e.value, p)) continue;
+				seen = true;
+				// The case matches the string if any of its clauses do.
+				if (!e.value.bytes) e.value.bytes = p.bytes;
+			}
+			if (!seen) d.cases.push_back(decision::edge{p, 0});
+		}
+		d.otherwise = build(others, rest);
+		std::vector<decision::edge> cases;
+		for (auto &e: d.cases) {
+			std::vector<unsigned> subset;
+			for (unsigned r: rows) {
+				const pattern &p = clauses[r].patterns[d.column];
+				if (p.type == kind::any || same(p, e.value)) {
+					subset.push_back(r);
+				}
+			}
+			e.next = build(subset, rest);
+			// A case which decides nothing the default does not is dropped.
+			if (e.next != d.otherwise) cases.push_back(e);
+		}
+		d.cases.swap(cases);
+		if (d.cases.empty()) {
+			return memo[key] = d.otherwise;
+		}
+	}
+	out.nodes.push_back(d);
+	return memo[key] = out.nodes.size() - 1;
+}
+
+// Finds some path from the root to a failure, describing the arguments
+// which take it.
+bool witness(const tree &t, unsigned node, std::vector<std::string> &args,
+		std::set<unsigned> &visited) {
+	const decision &d = t.nodes[node];
+	if (d.type == decision::kind::fail) return true;
+	if (d.type == decision::kind::leaf) return false;
+	if (!visited.insert(node).second) return false;
+	for (auto &e: d.cases) {
+		args[d.column] = show(e.value);
+		if (witness(t, e.next, args, visited)) return true;
+	}
+	// Any integer which no case names will do for the default.
+	std::set<int64_t> taken;
+	for (auto &e: d.cases) {
+		if (e.value.type == kind::integer) taken.insert(e.value.integer);
+	}
+	int64_t other = 0;
+	while (taken.count(other)) ++other;
+	args[d.column] = std::to_string(other);
+	if (witness(t, d.otherwise, args, visited)) return true;
+	args[d.column] = "_";
+	return false;
+}
+
+} // namespace
+
+bool match::read(const ast::node &params, clause *out, errors &err) {
+	std::vector<const ast::node*> items;
+	forms::elements(params, items);
+	bool ok = true;
+	for (auto item: items) {
+		pattern p;
+		p.origin = item->origin;
+		if (auto d = dynamic_cast<const ast::declare*>(item)) {
+			item = d->left.get();
+		}
+		if (auto i = dynamic_cast<const ast::identifier*>(item)) {
+			p.name = i->text;
+		} else if (auto n = dynamic_cast<const ast::integer*>(item)) {
+			p.type = kind::integer;
+			p.integer = n->value;
+		} else if (auto b = dynamic_cast<const ast::bytes*>(item)) {
+			// Single-byte strings stand for characters, as elsewhere, but
+			// an argument may still be the string itself.
+			p.bytes = b->value;
+			if (b->value->size() == 1) {
+				p.type = kind::integer;
+				p.integer = static_cast<unsigned char>(b->value->front());
+			} else {
+				p.type = kind::bytes;
+			}
+		} else if (!dynamic_cast<const ast::wildcard*>(item)) {
+			err.report(item->origin, "unsupported pattern");
+			ok = false;
+		}
+		out->patterns.push_back(p);
+	}
+	return ok;
+}
+
+bool match::plain(const clause &c) {
+	for (auto &p: c.patterns) {
+		if (p.type != kind::any || p.name.empty()) return false;
+	}
+	return true;
+}
+
+tree match::compile(const std::vector<clause> &clauses,
+		const std::string &name, errors &err) {
+	tree out;
+	builder b(clauses, out);
+	b.used.resize(clauses.size());
+	std::vector<unsigned> rows;
+	for (unsigned r = 0; r < clauses.size(); ++r) {
+		rows.push_back(r);
+	}
+	size_t width = clauses.empty()? 0: clauses[0].patterns.size();
+	out.root = b.build(rows, std::vector<bool>(width, true));
+	for (unsigned r = 0; r < clauses.size(); ++r) {
+		if (!b.used[r]) {
+			err.warn(clauses[r].origin, "clause of '" + name +
+					"' can never match; earlier clauses cover it");
+		}
+	}
+	std::vector<std::string> args(width, "_");
+	std::set<unsigned> visited;
+	if (!clauses.empty() && witness(out, out.root, args, visited)) {
+		std::string example;
+		for (auto &a: args) {
+			example += (example.empty()? "": ", ") + a;
+		}
+		err.warn(clauses[0].origin, "clauses of '" + name +
+				"' do not cover every argument, such as (" + example + ")");
+	}
+	return out;
+}
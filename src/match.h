@@ -0,0 +1,72 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include "ast.h"
+#include "errors.h"
+#include <string>
+#include <vector>
+
+// Compiles the clauses of a function into a decision tree. Each clause has
+// one pattern per argument: a name or a wildcard, which matches anything,
+// or an integer, character, or string literal. A character is a one-byte
+// string, which matches either that string or the byte's value. The tree
+// tests each argument at most once on any path, and identical subtrees are
+// shared, so matching costs one test per argument rather than one per
+// clause.
+namespace match {
+
+struct pattern {
+	enum class kind: uint8_t { any, integer, bytes };
+	kind type = kind::any;
+	int64_t integer = 0;
+	// Owned by a constants pool. A character written as a one-byte string
+	// is an integer pattern which keeps its string, since it matches both.
+	const std::string *bytes = nullptr;
+	std::string name; // bound to the argument, if not empty
+	location origin;
+};
+
+struct clause {
+	std::vector<pattern> patterns;
+	const ast::node *body = nullptr;
+	location origin;
+};
+
+// Reads a parameter list as patterns, reporting any it cannot match.
+bool read(const ast::node &params, clause*, errors&);
+
+// Is the clause an ordinary parameter list, which binds every argument?
+bool plain(const clause&);
+
+struct decision {
+	enum class kind: uint8_t { leaf, fail, test };
+	kind type = kind::fail;
+	unsigned clause = 0; // leaf: the clause which matched
+	unsigned column = 0; // test: the argument examined
+	struct edge {
+		pattern value;
+		unsigned next;
+	};
+	std::vector<edge> cases; // test: literals, in order of appearance
+	unsigned otherwise = 0; // test: where anything else goes
+};
+
+// A directed acyclic graph of decisions.
+struct tree {
+	std::vector<decision> nodes;
+	unsigned root = 0;
+};
+
+// Builds the tree, warning about clauses which can never match and, when
+// some arguments match no clause, giving an example of them.
+tree compile(const std::vector<clause>&, const std::string &name, errors&);
+
+} // namespace match
+
+#endif //MATCH_H
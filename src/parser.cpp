@@ -34,7 +34,11 @@ void parser::parse_number(std::string text, location loc) {
 
 void parser::parse_identifier(std::string text, location loc) {
 	prep_term(loc);
-	out.emit_identifier(text, loc);
+	if (text == "_") {
+		out.emit_wildcard(loc);
+	} else {
+		out.emit_identifier(text, loc);
+	}
 }
 
 void parser::parse_string(std::string text, location loc) {
@@ -51,6 +55,7 @@ void parser::parse_symbol(std::string text, location loc) {
 		{":", {syntax::declare, precedence::binding}},
 		{":=", {syntax::define, precedence::binding}},
 		{"::=", {syntax::typealias, precedence::binding}},
+		{"=>", {syntax::macro, precedence::binding}},
 		{"<-", {syntax::assign, precedence::binding}},
 		{"->", {syntax::capture, precedence::binding}},
 		{"=", {syntax::eq, precedence::relation}},
@@ -124,7 +129,7 @@ void parser::parse_delimiter(std::string text, location loc) {
 			push({loc, syntax::sequence, prec, text});
 		} break;
 		case ',': {
-			precedence prec = prep_operator(loc, precedence::binding);
+			precedence prec = prep_operator(loc, precedence::sequence);
 			push({loc, syntax::pair, prec, text});
 		} break;
 		default: {
@@ -137,8 +142,8 @@ void parser::reduce(precedence prec) {
 	bool rightassoc = false;
 	switch (prec) {
 		case precedence::binding:
-		case precedence::prefix: rightassoc = true;
-		default: rightassoc = false;
+		case precedence::prefix: rightassoc = true; break;
+		default: rightassoc = false; break;
 	}
 	while (!ops.empty()) {
 		if (prec > ops.top().prec) break;
@@ -0,0 +1,148 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "poller.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace runtime;
+
+namespace {
+
+// Bytes a stream process moves before giving others a turn, should its
+// descriptor never block.
+const size_t quantum = 1 << 20;
+
+int nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	return flags;
+}
+
+void restore(int fd, int flags) {
+	if (flags >= 0) fcntl(fd, F_SETFL, flags);
+}
+
+} // namespace
+
+poller::poller() {
+	epoll = epoll_create1(EPOLL_CLOEXEC);
+	stop = eventfd(0, EFD_CLOEXEC);
+	if (epoll < 0 || stop < 0) abort();
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.ptr = nullptr;
+	epoll_ctl(epoll, EPOLL_CTL_ADD, stop, &ev);
+	thread = std::thread(&poller::loop, this);
+}
+
+poller::~poller() {
+	uint64_t one = 1;
+	while (write(stop, &one, sizeof(one)) < 0 && errno == EINTR) {}
+	thread.join();
+	close(stop);
+	close(epoll);
+}
+
+bool poller::await(int fd, bool write, process *p) {
+	// One-shot, so that the process is woken once per wait, and the
+	// registration can simply be rearmed for the next.
+	epoll_event ev = {};
+	ev.events = (write? EPOLLOUT: EPOLLIN) | EPOLLONESHOT;
+	ev.data.ptr = p;
+	if (!epoll_ctl(epoll, EPOLL_CTL_MOD, fd, &ev)) return true;
+	if (errno != ENOENT) return false;
+	return !epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &ev);
+}
+
+void poller::forget(int fd) {
+	epoll_event ev = {};
+	epoll_ctl(epoll, EPOLL_CTL_DEL, fd, &ev);
+}
+
+void poller::loop() {
+	epoll_event ready[64];
+	for (;;) {
+		int n = epoll_wait(epoll, ready, 64, -1);
+		for (int i = 0; i < n; ++i) {
+			if (!ready[i].data.ptr) return;
+			static_cast<process*>(ready[i].data.ptr)->wake();
+		}
+	}
+}
+
+input::input(poller &p, int f, channel &o):
+		events(p), fd(f), flags(nonblocking(f)), out(o) {
+}
+
+input::~input() {
+	events.forget(fd);
+	restore(fd, flags);
+}
+
+process::status input::run() {
+	for (size_t moved = 0; moved < quantum; ) {
+		iovec spans[2];
+		int count = out.writable(spans);
+		if (!count) return status::blocked;
+		ssize_t n = readv(fd, spans, count);
+		if (n > 0) {
+			out.commit(n);
+			moved += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN) {
+			return events.await(fd, false, this)?
+					status::blocked: status::yield;
+		}
+		if (n < 0) error = errno;
+		out.close();
+		return status::done;
+	}
+	return status::yield;
+}
+
+output::output(poller &p, int f, channel &i):
+		events(p), fd(f), flags(nonblocking(f)), in(i) {
+}
+
+output::~output() {
+	events.forget(fd);
+	restore(fd, flags);
+}
+
+process::status output::run() {
+	for (size_t moved = 0; moved < quantum; ) {
+		iovec spans[2];
+		int count = in.readable(spans);
+		if (!count) return in.finished()? status::done: status::blocked;
+		if (error) {
+			for (int i = 0; i < count; ++i) {
+				in.consume(spans[i].iov_len);
+			}
+			continue;
+		}
+		ssize_t n = writev(fd, spans, count);
+		if (n > 0) {
+			in.consume(n);
+			moved += n;
+			continue;
+		}
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0 && errno == EAGAIN) {
+			return events.await(fd, true, this)?
+					status::blocked: status::yield;
+		}
+		error = n < 0? errno: EIO;
+	}
+	return status::yield;
+}
@@ -0,0 +1,70 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef POLLER_H
+#define POLLER_H
+
+#include "channel.h"
+#include "scheduler.h"
+#include <thread>
+
+namespace runtime {
+
+// One thread waiting in epoll on behalf of every process blocked on a
+// descriptor, so that no worker ever sits in a system call waiting for I/O.
+// Each descriptor serves one process at a time.
+class poller {
+public:
+	poller();
+	poller(const poller&) = delete;
+	~poller();
+	// Wakes the process once the descriptor is ready to read, or to write.
+	// Returns false if the descriptor cannot be polled, as with a regular
+	// file, which is always ready anyway.
+	bool await(int fd, bool write, process*);
+	void forget(int fd);
+private:
+	void loop();
+	int epoll;
+	int stop;
+	std::thread thread;
+};
+
+// Moves bytes from a descriptor into a channel, a readv at a time, straight
+// into the channel's free space; it sets the descriptor non-blocking while
+// it runs, restoring the old flags when it goes.
+class input: public process {
+public:
+	input(poller&, int fd, channel &out);
+	~input();
+	status run() override;
+	int error = 0;
+private:
+	poller &events;
+	int fd;
+	int flags;
+	channel &out;
+};
+
+// Moves bytes from a channel out to a descriptor, a writev at a time. If
+// the descriptor fails, the rest of the input is discarded, so that the
+// producer is never left waiting on a channel nobody reads.
+class output: public process {
+public:
+	output(poller&, int fd, channel &in);
+	~output();
+	status run() override;
+	int error = 0;
+private:
+	poller &events;
+	int fd;
+	int flags;
+	channel &in;
+};
+
+} // namespace runtime
+
+#endif //POLLER_H
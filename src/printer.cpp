@@ -0,0 +1,59 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "printer.h"
+
+namespace {
+struct writer: public ast::visitor {
+	writer(std::ostream &o): out(o) {}
+	virtual void visit(const ast::eof&) override { out << "(eof)"; }
+	virtual void visit(const ast::wildcard&) override { out << "_"; }
+	virtual void visit(const ast::null&) override { out << "()"; }
+	virtual void visit(const ast::number &n) override { out << n.text; }
+	virtual void visit(const ast::string &n) override { out << n.text; }
+	virtual void visit(const ast::identifier &n) override { out << n.text; }
+	virtual void visit(const ast::integer &n) override { out << n.value; }
+	virtual void visit(const ast::bytes &n) override {
+		out << "\"" << *n.value << "\"";
+	}
+	virtual void visit(const ast::apply &n) override { tree("apply", n); }
+	virtual void visit(const ast::pipe &n) override { tree("pipe", n); }
+	virtual void visit(const ast::sequence &n) override { tree("seq", n); }
+	virtual void visit(const ast::pair &n) override { tree("pair", n); }
+	virtual void visit(const ast::range &n) override { tree("range", n); }
+	virtual void visit(const ast::assign &n) override { tree("<-", n); }
+	virtual void visit(const ast::capture &n) override { tree("->", n); }
+	virtual void visit(const ast::declare &n) override { tree(":", n); }
+	virtual void visit(const ast::define &n) override { tree(":=", n); }
+	virtual void visit(const ast::typealias &n) override { tree("::=", n); }
+	virtual void visit(const ast::macro &n) override { tree("=>", n); }
+	virtual void visit(const ast::binop &n) override { tree(n.text, n); }
+	virtual void visit(const ast::conditional &n) override {
+		out << "(if ";
+		n.test->accept(*this);
+		out << " ";
+		n.consequent->accept(*this);
+		out << " ";
+		n.alternative->accept(*this);
+		out << ")";
+	}
+private:
+	void tree(std::string op, const ast::branch &n) {
+		out << "(" << op << " ";
+		n.left->accept(*this);
+		out << " ";
+		n.right->accept(*this);
+		out << ")";
+	}
+	std::ostream &out;
+};
+} // namespace
+
+void printer::process(ast::ptr &&n) {
+	writer w(out);
+	n->accept(w);
+	out << std::endl;
+}
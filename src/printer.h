@@ -0,0 +1,21 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef PRINTER_H
+#define PRINTER_H
+
+#include "ast.h"
+#include <ostream>
+
+// Writes each tree it receives as an s-expression, one tree per line.
+struct printer: public ast::delegate {
+	printer(std::ostream &o): out(o) {}
+	virtual void process(ast::ptr&&) override;
+private:
+	std::ostream &out;
+};
+
+#endif //PRINTER_H
@@ -0,0 +1,215 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "profiler.h"
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+#include <sys/time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace vm;
+
+namespace {
+
+// The time stamp counter, where there is one, and nanoseconds elsewhere.
+uint64_t cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+#endif
+}
+
+std::string percent(uint64_t part, uint64_t whole) {
+	std::ostringstream out;
+	out << std::fixed << std::setprecision(1);
+	out << (whole? 100.0 * part / whole: 0.0) << "%";
+	return out.str();
+}
+
+} // namespace
+
+std::atomic<unsigned> profiler::ticks{0};
+
+void profiler::tick(int) {
+	ticks.fetch_add(1, std::memory_order_relaxed);
+}
+
+profiler::profiler(const bytecode::program &p, mode m):
+		prog(p), how(m), functions(p.functions.size()) {
+	if (how != mode::sample) return;
+	ticks.store(0);
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = tick;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGPROF, &action, &previous);
+	itimerval timer;
+	timer.it_interval.tv_sec = 0;
+	timer.it_interval.tv_usec = interval;
+	timer.it_value = timer.it_interval;
+	setitimer(ITIMER_PROF, &timer, nullptr);
+	timing = true;
+}
+
+profiler::~profiler() {
+	stop();
+}
+
+void profiler::stop() {
+	while (!active.empty()) {
+		leave();
+	}
+	if (!timing) return;
+	itimerval off;
+	memset(&off, 0, sizeof(off));
+	setitimer(ITIMER_PROF, &off, nullptr);
+	sigaction(SIGPROF, &previous, nullptr);
+	timing = false;
+}
+
+void profiler::update(const machine &m) {
+	if (how == mode::instrument) {
+		while (active.size() > m.frames.size()) {
+			leave();
+		}
+		while (active.size() < m.frames.size()) {
+			enter(m.frames[active.size()].fn - prog.functions.data());
+		}
+	}
+	if (m.frames.empty()) return;
+	unsigned n = ticks.exchange(0, std::memory_order_relaxed);
+	if (!n) return;
+	samples += n;
+	std::vector<unsigned> stack;
+	for (auto &f: m.frames) {
+		stack.push_back(f.fn - prog.functions.data());
+	}
+	stacks[stack] += n;
+	const machine::frame &top = m.frames.back();
+	spots[std::make_pair(stack.back(), top.pc - top.fn->code.data())] += n;
+	functions[stack.back()].self += n;
+	// A recursive function counts once per sample, however deep it goes.
+	std::sort(stack.begin(), stack.end());
+	stack.erase(std::unique(stack.begin(), stack.end()), stack.end());
+	for (unsigned f: stack) {
+		functions[f].total += n;
+	}
+}
+
+void profiler::enter(unsigned function) {
+	totals &t = functions[function];
+	++t.calls;
+	++t.depth;
+	active.push_back(call{function, cycles(), 0});
+}
+
+void profiler::leave() {
+	call done = active.back();
+	uint64_t elapsed = cycles() - done.start;
+	uint64_t self = elapsed - std::min(elapsed, done.children);
+	std::vector<unsigned> stack;
+	for (auto &c: active) {
+		stack.push_back(c.function);
+	}
+	active.pop_back();
+	stacks[stack] += self;
+	totals &t = functions[done.function];
+	t.self += self;
+	if (--t.depth == 0) {
+		t.total += elapsed;
+	}
+	if (!active.empty()) {
+		active.back().children += elapsed;
+	}
+}
+
+std::string profiler::describe(unsigned function) const {
+	const bytecode::function &fn = prog.functions[function];
+	position p = fn.origin.begin;
+	return fn.name + " " + std::to_string(p.row()) + ":" +
+			std::to_string(p.col());
+}
+
+void profiler::report(std::ostream &out) const {
+	std::vector<unsigned> order;
+	uint64_t whole = 0;
+	for (unsigned f = 0; f < functions.size(); ++f) {
+		if (functions[f].calls || functions[f].total) order.push_back(f);
+		whole += functions[f].self;
+	}
+	auto heavier = [this](unsigned a, unsigned b) {
+		return functions[a].self > functions[b].self;
+	};
+	std::stable_sort(order.begin(), order.end(), heavier);
+	if (how == mode::instrument) {
+		out << std::setw(12) << "calls" << std::setw(8) << "self%";
+		out << std::setw(16) << "self cycles" << std::setw(16);
+		out << "total cycles" << "  function" << std::endl;
+		for (unsigned f: order) {
+			const totals &t = functions[f];
+			out << std::setw(12) << t.calls;
+			out << std::setw(8) << percent(t.self, whole);
+			out << std::setw(16) << t.self << std::setw(16) << t.total;
+			out << "  " << describe(f) << std::endl;
+		}
+		return;
+	}
+	out << samples << " samples, one per " << interval;
+	out << " us of CPU time" << std::endl;
+	out << std::setw(8) << "self%" << std::setw(10) << "self";
+	out << std::setw(10) << "total" << "  function" << std::endl;
+	for (unsigned f: order) {
+		const totals &t = functions[f];
+		out << std::setw(8) << percent(t.self, samples);
+		out << std::setw(10) << t.self << std::setw(10) << t.total;
+		out << "  " << describe(f) << std::endl;
+	}
+	// Instructions from the same expression share its location.
+	std::map<std::pair<unsigned, std::string>, uint64_t> lines;
+	for (auto &s: spots) {
+		const bytecode::function &fn = prog.functions[s.first.first];
+		size_t pc = s.first.second;
+		location loc = pc < fn.origins.size()? fn.origins[pc]: fn.origin;
+		std::string where = std::to_string(loc.begin.row()) + ":" +
+				std::to_string(loc.begin.col());
+		lines[std::make_pair(s.first.first, where)] += s.second;
+	}
+	std::vector<std::pair<uint64_t, std::string>> hot;
+	for (auto &l: lines) {
+		hot.emplace_back(l.second,
+				l.first.second + " in " + prog.functions[l.first.first].name);
+	}
+	std::stable_sort(hot.begin(), hot.end(),
+			[](const std::pair<uint64_t, std::string> &a,
+					const std::pair<uint64_t, std::string> &b) {
+				return a.first > b.first;
+			});
+	out << std::endl << std::setw(8) << "self%" << std::setw(10) << "self";
+	out << "  location" << std::endl;
+	for (auto &h: hot) {
+		out << std::setw(8) << percent(h.first, samples);
+		out << std::setw(10) << h.first << "  " << h.second << std::endl;
+	}
+}
+
+void profiler::folded(std::ostream &out) const {
+	for (auto &s: stacks) {
+		if (!s.second) continue;
+		for (size_t i = 0; i < s.first.size(); ++i) {
+			if (i) out << ";";
+			out << describe(s.first[i]);
+		}
+		out << " " << s.second << std::endl;
+	}
+}
@@ -0,0 +1,85 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "vm.h"
+#include <atomic>
+#include <map>
+#include <ostream>
+#include <signal.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// Attributes the time a machine spends to the functions of its program and
+// the source locations of their code. Sampling records the machine's stack
+// at each tick of a CPU-time timer, which costs little, so the program runs
+// at close to its usual speed; instrumenting counts every call and the
+// cycles spent in it, which is exact but slows the program down. Only one
+// sampling profiler may run at a time, since the timer belongs to the
+// process.
+class profiler {
+public:
+	enum class mode { sample, instrument };
+	profiler(const bytecode::program&, mode);
+	profiler(const profiler&) = delete;
+	~profiler();
+	// The machine calls this before each instruction; it does nothing more
+	// than a test or two unless a sample is due or a call began or ended.
+	void step(const machine &m) {
+		bool due = ticks.load(std::memory_order_relaxed) != 0;
+		if (due || (how == mode::instrument &&
+				m.frames.size() != active.size())) {
+			update(m);
+		}
+	}
+	// Drops samples taken since the last instruction ran.
+	void discard() { ticks.store(0, std::memory_order_relaxed); }
+	// Ends any calls still in progress and stops the timer.
+	void stop();
+	// Lists time by function, and for sampling, by source location too.
+	void report(std::ostream&) const;
+	// One line per distinct stack, from the outermost function inward, with
+	// its weight: in samples, or in cycles spent in the innermost function.
+	void folded(std::ostream&) const;
+	static const unsigned interval = 1000; // microseconds between samples
+private:
+	static std::atomic<unsigned> ticks; // timer signals not yet recorded
+	static void tick(int);
+	void update(const machine&);
+	void enter(unsigned function);
+	void leave();
+	std::string describe(unsigned function) const;
+	const bytecode::program &prog;
+	mode how;
+	bool timing = false;
+	struct sigaction previous;
+	struct call {
+		unsigned function;
+		uint64_t start;
+		uint64_t children; // cycles spent in calls it made
+	};
+	std::vector<call> active;
+	struct totals {
+		uint64_t calls = 0;
+		uint64_t self = 0; // samples or cycles
+		uint64_t total = 0; // including callees
+		unsigned depth = 0; // activations in progress
+	};
+	std::vector<totals> functions;
+	// Samples by the instruction which was about to run.
+	std::map<std::pair<unsigned, size_t>, uint64_t> spots;
+	std::map<std::vector<unsigned>, uint64_t> stacks;
+	uint64_t samples = 0;
+};
+
+} // namespace vm
+
+#endif //PROFILER_H
@@ -0,0 +1,132 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "rewrite.h"
+
+using namespace ast;
+
+ptr rewrite::operator()(const node &n) {
+	n.accept(*this);
+	return std::move(result);
+}
+
+void rewrite::make(node *n) {
+	result = cons? (*cons)(n): ptr(n);
+}
+
+ptr ast::share(const node &n) {
+	return ptr(const_cast<node*>(&n));
+}
+
+template <typename T> void rewrite::branch(const T &n) {
+	ptr left = (*this)(*n.left);
+	ptr right = (*this)(*n.right);
+	if (left.get() == n.left.get() && right.get() == n.right.get()) {
+		result = share(n);
+	} else {
+		make(new T(std::move(left), std::move(right), n.origin));
+	}
+}
+
+void rewrite::visit(const eof &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const wildcard &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const null &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const number &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const string &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const identifier &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const integer &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const bytes &n) {
+	result = share(n);
+}
+
+void rewrite::visit(const apply &n) {
+	branch(n);
+}
+
+void rewrite::visit(const pipe &n) {
+	branch(n);
+}
+
+void rewrite::visit(const sequence &n) {
+	branch(n);
+}
+
+void rewrite::visit(const pair &n) {
+	branch(n);
+}
+
+void rewrite::visit(const range &n) {
+	branch(n);
+}
+
+void rewrite::visit(const assign &n) {
+	branch(n);
+}
+
+void rewrite::visit(const capture &n) {
+	branch(n);
+}
+
+void rewrite::visit(const declare &n) {
+	branch(n);
+}
+
+void rewrite::visit(const define &n) {
+	branch(n);
+}
+
+void rewrite::visit(const typealias &n) {
+	branch(n);
+}
+
+void rewrite::visit(const macro &n) {
+	branch(n);
+}
+
+void rewrite::visit(const binop &n) {
+	ptr left = (*this)(*n.left);
+	ptr right = (*this)(*n.right);
+	if (left.get() == n.left.get() && right.get() == n.right.get()) {
+		result = share(n);
+		return;
+	}
+	make(new binop(n.id, n.text, std::move(left), std::move(right), n.origin));
+}
+
+void rewrite::visit(const conditional &n) {
+	ptr test = (*this)(*n.test);
+	ptr consequent = (*this)(*n.consequent);
+	ptr alternative = (*this)(*n.alternative);
+	if (test.get() == n.test.get() &&
+			consequent.get() == n.consequent.get() &&
+			alternative.get() == n.alternative.get()) {
+		result = share(n);
+		return;
+	}
+	make(new conditional(std::move(test),
+			std::move(consequent), std::move(alternative), n.origin));
+}
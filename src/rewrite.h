@@ -0,0 +1,59 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef REWRITE_H
+#define REWRITE_H
+
+#include "ast.h"
+#include "builder.h"
+
+namespace ast {
+
+// Base for passes which build a new tree from an old one. Each visit method
+// leaves the replacement for its node in 'result'. The default methods
+// rewrite the node's children and keep the node itself unless one of them
+// changed, so a pass only overrides the node types it actually changes, and
+// the subtrees it leaves alone stay shared wherever they appear. Given a
+// builder, the nodes a pass does build are shared as well.
+struct rewrite: public visitor {
+	ptr operator()(const node&);
+	virtual void visit(const eof&) override;
+	virtual void visit(const wildcard&) override;
+	virtual void visit(const null&) override;
+	virtual void visit(const number&) override;
+	virtual void visit(const string&) override;
+	virtual void visit(const identifier&) override;
+	virtual void visit(const integer&) override;
+	virtual void visit(const bytes&) override;
+	virtual void visit(const apply&) override;
+	virtual void visit(const pipe&) override;
+	virtual void visit(const sequence&) override;
+	virtual void visit(const pair&) override;
+	virtual void visit(const range&) override;
+	virtual void visit(const assign&) override;
+	virtual void visit(const capture&) override;
+	virtual void visit(const declare&) override;
+	virtual void visit(const define&) override;
+	virtual void visit(const typealias&) override;
+	virtual void visit(const macro&) override;
+	virtual void visit(const binop&) override;
+	virtual void visit(const conditional&) override;
+	builder *cons = nullptr;
+protected:
+	// Makes a new node the result, or the one built before which is the same.
+	void make(node*);
+	ptr result;
+private:
+	template <typename T> void branch(const T&);
+};
+
+// Another reference to a node which is already part of a tree; since nodes
+// never change, this stands in for a copy.
+ptr share(const node&);
+
+} // namespace ast
+
+#endif //REWRITE_H
@@ -0,0 +1,263 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "scheduler.h"
+#include <algorithm>
+#include <thread>
+
+using namespace runtime;
+
+// Chase-Lev work-stealing deque, as given for C11 atomics by Le, Pop, Cohen
+// and Zappa Nardelli. Only the owning worker pushes and pops, at the bottom;
+// thieves take from the top. Outgrown arrays are kept until the deque goes,
+// since a thief may still be reading one.
+class scheduler::deque {
+public:
+	deque() {
+		arrays.emplace_back(new array(64));
+		current = arrays.back().get();
+	}
+	void push(process *p) {
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		array *a = current.load(std::memory_order_relaxed);
+		if (b - t > int64_t(a->size) - 1) {
+			array *bigger = new array(a->size * 2);
+			for (int64_t i = t; i < b; ++i) {
+				bigger->put(i, a->get(i));
+			}
+			arrays.emplace_back(bigger);
+			current.store(bigger, std::memory_order_release);
+			a = bigger;
+		}
+		a->put(b, p);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+	process *pop() {
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		array *a = current.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		process *out = nullptr;
+		if (t <= b) {
+			out = a->get(b);
+			if (t == b) {
+				// Racing thieves for the last one.
+				if (!top.compare_exchange_strong(t, t + 1,
+						std::memory_order_seq_cst,
+						std::memory_order_relaxed)) {
+					out = nullptr;
+				}
+				bottom.store(b + 1, std::memory_order_relaxed);
+			}
+		} else {
+			bottom.store(b + 1, std::memory_order_relaxed);
+		}
+		return out;
+	}
+	process *steal() {
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t >= b) return nullptr;
+		array *a = current.load(std::memory_order_acquire);
+		process *out = a->get(t);
+		if (!top.compare_exchange_strong(t, t + 1,
+				std::memory_order_seq_cst, std::memory_order_relaxed)) {
+			return nullptr;
+		}
+		return out;
+	}
+	bool empty() const {
+		return bottom.load(std::memory_order_relaxed) <=
+				top.load(std::memory_order_relaxed);
+	}
+private:
+	struct array {
+		explicit array(size_t n):
+				size(n), items(new std::atomic<process*>[n]) {}
+		process *get(int64_t i) const {
+			return items[i & (size - 1)].load(std::memory_order_relaxed);
+		}
+		void put(int64_t i, process *p) {
+			items[i & (size - 1)].store(p, std::memory_order_relaxed);
+		}
+		size_t size;
+		std::unique_ptr<std::atomic<process*>[]> items;
+	};
+	// Thieves and the owner contend for different cache lines.
+	std::atomic<int64_t> top{0};
+	char spacing[64];
+	std::atomic<int64_t> bottom{0};
+	std::atomic<array*> current;
+	std::vector<std::unique_ptr<array>> arrays;
+};
+
+struct scheduler::worker {
+	deque work;
+	unsigned victim = 0; // where to try stealing first
+};
+
+// The worker running on this thread, if any, and its index.
+static thread_local scheduler *running_on = nullptr;
+static thread_local unsigned running_index = 0;
+
+void process::wake() {
+	state s = now.load();
+	for (;;) {
+		switch (s) {
+			case state::idle:
+				if (!now.compare_exchange_weak(s, state::queued)) continue;
+				owner->schedule(this);
+				return;
+			case state::running:
+				// It will go back on the queue when its turn ends.
+				if (!now.compare_exchange_weak(s, state::notified)) continue;
+				return;
+			case state::queued: case state::notified: case state::finished:
+				return;
+		}
+	}
+}
+
+scheduler::scheduler(unsigned workers) {
+	count = workers? workers: std::thread::hardware_concurrency();
+	count = std::max(count, 1u);
+	for (unsigned i = 0; i < count; ++i) {
+		pool.emplace_back(new worker);
+		pool.back()->victim = (i + 1) % count;
+	}
+}
+
+scheduler::~scheduler() {
+}
+
+void scheduler::spawn(process *p) {
+	p->owner = this;
+	p->now = process::state::queued;
+	live.fetch_add(1);
+	schedule(p);
+}
+
+void scheduler::schedule(process *p) {
+	if (running_on == this) {
+		pool[running_index]->work.push(p);
+	} else {
+		std::lock_guard<std::mutex> hold(shared_lock);
+		shared.push_back(p);
+		shared_size.fetch_add(1);
+	}
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (sleepers.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> hold(sleep_lock);
+		++signals;
+		sleep.notify_one();
+	}
+}
+
+void scheduler::run() {
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < count; ++i) {
+		threads.emplace_back(&scheduler::loop, this, i);
+	}
+	loop(0);
+	for (auto &t: threads) {
+		t.join();
+	}
+}
+
+process *scheduler::find(unsigned index) {
+	worker &self = *pool[index];
+	if (process *p = self.work.pop()) return p;
+	if (shared_size.load(std::memory_order_relaxed)) {
+		std::lock_guard<std::mutex> hold(shared_lock);
+		if (!shared.empty()) {
+			process *p = shared.front();
+			shared.pop_front();
+			shared_size.fetch_sub(1);
+			return p;
+		}
+	}
+	for (unsigned i = 0; i + 1 < count; ++i) {
+		unsigned victim = (self.victim + i) % count;
+		if (victim == index) continue;
+		if (process *p = pool[victim]->work.steal()) {
+			// Whoever had work once is likely to have more.
+			self.victim = victim;
+			return p;
+		}
+	}
+	return nullptr;
+}
+
+bool scheduler::pending() {
+	if (shared_size.load() || !live.load()) return true;
+	for (auto &w: pool) {
+		if (!w->work.empty()) return true;
+	}
+	return false;
+}
+
+void scheduler::loop(unsigned index) {
+	running_on = this;
+	running_index = index;
+	while (live.load(std::memory_order_acquire)) {
+		if (process *p = find(index)) {
+			execute(p);
+			continue;
+		}
+		// Announce the intention to sleep before the final look for work,
+		// so that anything scheduled after that look will signal.
+		std::unique_lock<std::mutex> hold(sleep_lock);
+		uint64_t seen = signals;
+		sleepers.fetch_add(1);
+		hold.unlock();
+		if (!pending()) {
+			hold.lock();
+			while (signals == seen && live.load()) {
+				sleep.wait(hold);
+			}
+			hold.unlock();
+		}
+		sleepers.fetch_sub(1);
+	}
+	running_on = nullptr;
+}
+
+void scheduler::execute(process *p) {
+	typedef process::state state;
+	p->now = state::running;
+	switch (p->run()) {
+		case process::status::done:
+			p->now = state::finished;
+			finish();
+			return;
+		case process::status::yield: {
+			p->now = state::queued;
+			std::lock_guard<std::mutex> hold(shared_lock);
+			shared.push_back(p);
+			shared_size.fetch_add(1);
+			return;
+		}
+		case process::status::blocked: {
+			state s = state::running;
+			if (p->now.compare_exchange_strong(s, state::idle)) return;
+			// Woken while it ran, so the reason it blocked may be gone.
+			p->now = state::queued;
+			schedule(p);
+			return;
+		}
+	}
+}
+
+void scheduler::finish() {
+	if (live.fetch_sub(1) != 1) return;
+	std::lock_guard<std::mutex> hold(sleep_lock);
+	++signals;
+	sleep.notify_all();
+}
@@ -0,0 +1,87 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace runtime {
+
+class scheduler;
+
+// A lightweight process is a stackless coroutine: the scheduler calls run(),
+// which keeps its own state between calls and returns whenever it cannot
+// make progress, so no thread is ever tied up waiting on one.
+class process {
+public:
+	enum class status: uint8_t {
+		blocked, // until something wakes it
+		yield, // runnable, but letting others have a turn
+		done
+	};
+	process() {}
+	process(const process&) = delete;
+	virtual ~process() {}
+	virtual status run() = 0;
+	// Makes a blocked process runnable again; any thread may call this, and
+	// waking a process which is not blocked does no harm.
+	void wake();
+private:
+	friend class scheduler;
+	enum class state: uint8_t { idle, queued, running, notified, finished };
+	std::atomic<state> now{state::idle};
+	scheduler *owner = nullptr;
+};
+
+// Runs processes on a pool of worker threads. Each worker keeps a deque of
+// runnable processes, taking work from its own end and stealing from the
+// opposite end of the others' when it runs out; processes woken by a worker
+// go onto that worker's deque, so a consumer tends to run on the core whose
+// cache holds the data its producer just wrote.
+class scheduler {
+public:
+	explicit scheduler(unsigned workers = 0); // 0 means one per core
+	~scheduler();
+	// The scheduler does not own the process, which must outlive run().
+	void spawn(process*);
+	// Runs until every spawned process is done.
+	void run();
+	unsigned workers() const { return count; }
+private:
+	friend class process;
+	class deque;
+	struct worker;
+	void schedule(process*);
+	void loop(unsigned index);
+	process *find(unsigned index);
+	bool pending();
+	void execute(process*);
+	void finish();
+	unsigned count;
+	std::vector<std::unique_ptr<worker>> pool;
+	// Processes spawned or woken from outside the workers, and those which
+	// yielded, wait here so that they do not jump ahead of everything else.
+	std::mutex shared_lock;
+	std::deque<process*> shared;
+	std::atomic<size_t> shared_size{0};
+	std::atomic<size_t> live{0};
+	// Idle workers sleep until signalled.
+	std::mutex sleep_lock;
+	std::condition_variable sleep;
+	std::atomic<unsigned> sleepers{0};
+	uint64_t signals = 0;
+};
+
+} // namespace runtime
+
+#endif //SCHEDULER_H
@@ -0,0 +1,342 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "server.h"
+#include "cgen.h"
+#include "escape.h"
+#include <errno.h>
+#include <limits.h>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+using namespace server;
+
+namespace {
+
+// The request is the command and the path, each ending in a NUL.
+const size_t request_limit = PATH_MAX + 64;
+
+uint64_t fingerprint(const std::string &text) {
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c: text) {
+		hash = (hash ^ c) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+bool address(const std::string &path, sockaddr_un *out) {
+	memset(out, 0, sizeof(*out));
+	out->sun_family = AF_UNIX;
+	if (path.size() >= sizeof(out->sun_path)) {
+		std::cerr << path << ": socket path is too long" << std::endl;
+		return false;
+	}
+	memcpy(out->sun_path, path.data(), path.size());
+	return true;
+}
+
+int connect_to(const sockaddr_un &addr) {
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) return -1;
+	auto where = reinterpret_cast<const sockaddr*>(&addr);
+	if (connect(fd, where, sizeof(addr)) == 0) return fd;
+	int error = errno;
+	close(fd);
+	errno = error;
+	return -1;
+}
+
+bool send(int fd, const std::string &text) {
+	runtime::sink out(fd);
+	auto data = reinterpret_cast<const uint8_t*>(text.data());
+	return out.write(data, text.size()) && out.flush();
+}
+
+// Reads a request and the descriptors which came with it, which should be
+// the client's stdout and stderr.
+bool receive(int conn, std::string *command, std::string *path, int fds[2]) {
+	std::string data;
+	char buffer[256];
+	std::vector<int> passed;
+	for (;;) {
+		iovec v = {buffer, sizeof(buffer)};
+		union {
+			cmsghdr align;
+			char space[CMSG_SPACE(2 * sizeof(int))];
+		} control;
+		msghdr m;
+		memset(&m, 0, sizeof(m));
+		m.msg_iov = &v;
+		m.msg_iovlen = 1;
+		m.msg_control = control.space;
+		m.msg_controllen = sizeof(control.space);
+		ssize_t n = recvmsg(conn, &m, MSG_CMSG_CLOEXEC);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		for (cmsghdr *c = CMSG_FIRSTHDR(&m); c; c = CMSG_NXTHDR(&m, c)) {
+			if (c->cmsg_level != SOL_SOCKET) continue;
+			if (c->cmsg_type != SCM_RIGHTS) continue;
+			size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			const int *in = reinterpret_cast<const int*>(CMSG_DATA(c));
+			passed.insert(passed.end(), in, in + count);
+		}
+		data.append(buffer, n);
+		size_t split = data.find('\0');
+		if (split != std::string::npos &&
+				data.find('\0', split + 1) != std::string::npos) {
+			*command = data.substr(0, split);
+			*path = data.c_str() + split + 1;
+			break;
+		}
+		if (data.size() > request_limit) break;
+	}
+	bool ok = !command->empty() && passed.size() == 2;
+	for (size_t i = 0; i < passed.size(); ++i) {
+		if (ok && i < 2) {
+			fds[i] = passed[i];
+		} else {
+			close(passed[i]);
+		}
+	}
+	return ok;
+}
+
+struct entry {
+	uint64_t hash;
+	size_t size;
+	std::shared_ptr<const module> mod;
+	uint64_t used; // when it was last looked up, by the service's clock
+};
+
+class service {
+public:
+	explicit service(frontend f): compile(f) {}
+	void handle(int conn);
+private:
+	std::shared_ptr<const module> lookup(const std::string&, std::ostream&);
+	int answer(const std::string&, const module&, std::ostream &out,
+			std::ostream &err);
+	frontend compile;
+	std::mutex lock;
+	std::unordered_map<std::string, entry> cache;
+	uint64_t clock = 0;
+};
+
+void service::handle(int conn) {
+	std::string command, path;
+	int fds[2];
+	if (!receive(conn, &command, &path, fds)) {
+		close(conn);
+		return;
+	}
+	std::ostringstream out, err;
+	int status = EXIT_FAILURE;
+	if (!known(command)) {
+		err << "unknown command: " << command << std::endl;
+	} else if (auto mod = lookup(path, err)) {
+		status = answer(command, *mod, out, err);
+	}
+	send(fds[1], err.str());
+	send(fds[0], out.str());
+	close(fds[0]);
+	close(fds[1]);
+	uint8_t code = status;
+	while (write(conn, &code, 1) < 0 && errno == EINTR) {}
+	close(conn);
+}
+
+// Yields the module for the file's current contents, compiling them only if
+// they differ from what was compiled last time.
+std::shared_ptr<const module> service::lookup(
+		const std::string &path, std::ostream &err) {
+	std::unique_ptr<runtime::source> file = runtime::open_source(path);
+	if (!file) {
+		int error = errno;
+		std::lock_guard<std::mutex> hold(lock);
+		cache.erase(path);
+		err << path << ": " << strerror(error) << std::endl;
+		return nullptr;
+	}
+	std::string text;
+	const uint8_t *data;
+	while (size_t n = file->next(&data)) {
+		text.append(reinterpret_cast<const char*>(data), n);
+	}
+	if (file->failed()) {
+		err << path << ": " << strerror(file->error) << std::endl;
+		return nullptr;
+	}
+	uint64_t hash = fingerprint(text);
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		auto i = cache.find(path);
+		if (i != cache.end() &&
+				i->second.hash == hash && i->second.size == text.size()) {
+			i->second.used = ++clock;
+			return i->second.mod;
+		}
+	}
+	// Two clients asking about the same new contents at once may both
+	// compile them; that costs less than holding the lock while one does.
+	std::shared_ptr<module> mod(new module);
+	std::ostringstream diagnostics;
+	errors e(diagnostics);
+	std::unique_ptr<runtime::source> in = runtime::string_source(text);
+	mod->ok = compile(*in, *mod, e);
+	mod->diagnostics = diagnostics.str();
+	std::lock_guard<std::mutex> hold(lock);
+	cache[path] = entry{hash, text.size(), mod, ++clock};
+	if (cache.size() > cache_limit) {
+		// A scan is cheap next to the compile which just happened.
+		auto oldest = cache.begin();
+		for (auto i = cache.begin(); i != cache.end(); ++i) {
+			if (i->second.used < oldest->second.used) oldest = i;
+		}
+		cache.erase(oldest);
+	}
+	return mod;
+}
+
+int service::answer(const std::string &command, const module &m,
+		std::ostream &out, std::ostream &err) {
+	err << m.diagnostics;
+	if (!m.ok) return EXIT_FAILURE;
+	if (command == "-S") {
+		bytecode::disassemble(m.prog, out);
+	} else if (command == "-emit-c") {
+		cgen(out).generate(m.prog);
+	} else if (command == "-escape") {
+		// The analysis marks the code it reads, and other threads may be
+		// reading this module, so it gets a copy.
+		bytecode::program prog = m.prog;
+		std::vector<escape::site> sites;
+		escape::analyze(prog, &sites);
+		for (auto &s: sites) {
+			out << escape::describe(prog, s) << std::endl;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+} // namespace
+
+std::string server::default_socket() {
+	if (const char *path = getenv("RFL_SOCKET")) return path;
+	const char *dir = getenv("TMPDIR");
+	std::string out = (dir && *dir)? dir: "/tmp";
+	return out + "/rfl-" + std::to_string(getuid()) + ".sock";
+}
+
+bool server::known(const std::string &command) {
+	return command == "check" || command == "-S" ||
+			command == "-emit-c" || command == "-escape";
+}
+
+int server::serve(const std::string &path, frontend f) {
+	sockaddr_un addr;
+	if (!address(path, &addr)) return EXIT_FAILURE;
+	// A socket left behind by a daemon which has died refuses connections,
+	// and can be replaced; one which answers belongs to a live daemon.
+	int probe = connect_to(addr);
+	if (probe >= 0) {
+		close(probe);
+		std::cerr << path << ": a daemon is already listening" << std::endl;
+		return EXIT_FAILURE;
+	}
+	unlink(path.c_str());
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		std::cerr << "socket: " << strerror(errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+	// Only this user may connect.
+	mode_t mask = umask(077);
+	int bound = bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr));
+	umask(mask);
+	if (bound || listen(fd, SOMAXCONN)) {
+		std::cerr << path << ": " << strerror(errno) << std::endl;
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	// A client which goes away must not take the daemon with it.
+	signal(SIGPIPE, SIG_IGN);
+	// Never freed, since handlers may still be running if accept fails.
+	service *s = new service(f);
+	for (;;) {
+		int conn = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			std::cerr << "accept: " << strerror(errno) << std::endl;
+			close(fd);
+			return EXIT_FAILURE;
+		}
+		std::thread([s, conn]() { s->handle(conn); }).detach();
+	}
+}
+
+int server::request(const std::string &socket, const std::string &command,
+		const char *path) {
+	char absolute[PATH_MAX];
+	if (!realpath(path, absolute)) {
+		std::cerr << path << ": " << strerror(errno) << std::endl;
+		return EXIT_FAILURE;
+	}
+	sockaddr_un addr;
+	if (!address(socket, &addr)) return EXIT_FAILURE;
+	int fd = connect_to(addr);
+	if (fd < 0) {
+		std::cerr << socket << ": no daemon is listening (";
+		std::cerr << strerror(errno) << ")" << std::endl;
+		return EXIT_FAILURE;
+	}
+	std::string message = command + '\0' + absolute + '\0';
+	iovec v = {&message[0], message.size()};
+	int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+	union {
+		cmsghdr align;
+		char space[CMSG_SPACE(sizeof(fds))];
+	} control;
+	memset(&control, 0, sizeof(control));
+	msghdr m;
+	memset(&m, 0, sizeof(m));
+	m.msg_iov = &v;
+	m.msg_iovlen = 1;
+	m.msg_control = control.space;
+	m.msg_controllen = sizeof(control.space);
+	cmsghdr *c = CMSG_FIRSTHDR(&m);
+	c->cmsg_level = SOL_SOCKET;
+	c->cmsg_type = SCM_RIGHTS;
+	c->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(c), fds, sizeof(fds));
+	ssize_t sent;
+	while ((sent = sendmsg(fd, &m, 0)) < 0 && errno == EINTR) {}
+	if (sent != ssize_t(message.size())) {
+		std::cerr << socket << ": " << strerror(errno) << std::endl;
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	uint8_t status = EXIT_FAILURE;
+	ssize_t got;
+	while ((got = read(fd, &status, 1)) < 0 && errno == EINTR) {}
+	close(fd);
+	if (got != 1) {
+		std::cerr << socket << ": the daemon did not answer" << std::endl;
+		return EXIT_FAILURE;
+	}
+	return status;
+}
@@ -0,0 +1,60 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "bytecode.h"
+#include "constants.h"
+#include "errors.h"
+#include "stream.h"
+#include <functional>
+#include <string>
+
+// A compiler which stays running between builds. The daemon listens on a
+// Unix socket; each client sends a command and the absolute path of a
+// program, along with its own stdout and stderr, which the daemon writes to
+// directly before it replies with the exit status. Compiled programs stay in
+// memory, keyed by path, and are reused for as long as the file's contents
+// hash the same, so a build which asks about the same file again, or about
+// files which have not changed since the last build, compiles nothing. A
+// file which can no longer be read is forgotten, and past a limit the module
+// used least recently makes way for a new one.
+namespace server {
+
+// Most modules the daemon keeps at once.
+const size_t cache_limit = 256;
+
+// A program as the front end left it, with the messages it printed.
+struct module {
+	constants pool; // the bytecode refers to its strings
+	bytecode::program prog;
+	std::string diagnostics;
+	bool ok = false;
+};
+
+// Compiles source text into the module, reporting problems to the errors.
+typedef std::function<bool(runtime::source&, module&, errors&)> frontend;
+
+// $RFL_SOCKET, or else a socket named for the user in the temp directory.
+std::string default_socket();
+
+// The commands a client may send: "check", which only prints messages, and
+// "-S", "-emit-c", and "-escape", which print what they do on the command
+// line.
+bool known(const std::string &command);
+
+// Serves clients until killed, compiling on a thread for each connection.
+// Returns only if the socket could not be set up.
+int serve(const std::string &socket, frontend);
+
+// Asks the daemon to run the command on a file, returning its exit status.
+int request(const std::string &socket, const std::string &command,
+		const char *path);
+
+} // namespace server
+
+#endif //SERVER_H
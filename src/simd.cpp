@@ -0,0 +1,574 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "simd.h"
+#include "simd_lanes.h"
+#include <algorithm>
+#include <map>
+
+using namespace simd;
+using bytecode::instr;
+
+namespace {
+
+// Number of operands which are steps, in the order a, b, c.
+unsigned arity(op code) {
+	switch (code) {
+		case op::input: case op::constant: case op::uniform: return 0;
+		case op::inv: case op::neg: return 1;
+		case op::select: case op::lookup: return 3;
+		default: return 2;
+	}
+}
+
+// Finds the multiplier and shift for signed 16-bit division by 'd', where
+// 2 <= |d| < 2^15, following Hacker's Delight.
+void reciprocal(int d, int16_t *magic, int16_t *bits) {
+	uint32_t ad = d < 0? -d: d, two15 = 0x8000;
+	uint32_t t = two15 + (d < 0);
+	uint32_t anc = t - 1 - t % ad;
+	uint32_t q1 = two15 / anc, r1 = two15 - q1 * anc;
+	uint32_t q2 = two15 / ad, r2 = two15 - q2 * ad, delta;
+	int p = 15;
+	do {
+		++p;
+		q1 *= 2;
+		r1 *= 2;
+		if (r1 >= anc) {
+			++q1;
+			r1 -= anc;
+		}
+		q2 *= 2;
+		r2 *= 2;
+		if (r2 >= ad) {
+			++q2;
+			r2 -= ad;
+		}
+		delta = ad - r2;
+	} while (q1 < delta || (q1 == delta && r1 == 0));
+	int16_t m = q2 + 1;
+	*magic = d < 0? -m: m;
+	*bits = p - 16;
+}
+
+// If-converts a loop body which branches only forward. Each path through the
+// body carries a mask of the lanes taking it, along with the step holding
+// the value of each register it has assigned; where paths join, registers
+// on which they disagree are selected lane by lane. Registers the loop never
+// assigns are uniform.
+class converter {
+public:
+	converter(const bytecode::program&, const bytecode::function&, kernel&);
+	void assign(unsigned reg) { assigned[reg] = true; }
+	bool convert(size_t top, size_t end, unsigned item, unsigned value);
+private:
+	typedef std::map<unsigned, unsigned> registers;
+	struct path {
+		unsigned lanes;
+		registers regs;
+	};
+	unsigned emit(op, unsigned a, unsigned b = 0, unsigned c = 0,
+			bool mask = false);
+	unsigned constant(int64_t);
+	bool get(unsigned reg, unsigned *out);
+	bool invariant(unsigned s) const;
+	unsigned invert(unsigned s);
+	unsigned nonzero(unsigned s);
+	unsigned both(unsigned lanes, unsigned mask);
+	unsigned except(unsigned lanes, unsigned mask);
+	bool branch(size_t from, size_t to, const path&);
+	void join(size_t pc);
+	bool translate(const instr&, size_t pc);
+	bool arithmetic(const instr&);
+	const bytecode::program &prog;
+	const bytecode::function &fn;
+	kernel &out;
+	std::vector<bool> assigned;
+	std::map<unsigned, unsigned> uniforms;
+	std::map<int64_t, unsigned> constants;
+	std::map<size_t, std::vector<path>> pending;
+	path cur;
+	bool live = true;
+	unsigned all = 0;
+	size_t end = 0;
+};
+
+converter::converter(const bytecode::program &p,
+		const bytecode::function &f, kernel &k):
+		prog(p), fn(f), out(k), assigned(f.registers, false) {
+}
+
+unsigned converter::emit(op code, unsigned a, unsigned b, unsigned c,
+		bool mask) {
+	step s;
+	s.code = code;
+	s.a = a;
+	s.b = b;
+	s.c = c;
+	s.mask = mask;
+	out.steps.push_back(s);
+	return out.steps.size() - 1;
+}
+
+unsigned converter::constant(int64_t value) {
+	auto found = constants.find(value);
+	if (found != constants.end()) return found->second;
+	unsigned s = emit(op::constant, 0, 0, 0, value == 0 || value == -1);
+	out.steps[s].value = value;
+	constants[value] = s;
+	return s;
+}
+
+bool converter::get(unsigned reg, unsigned *s) {
+	auto found = cur.regs.find(reg);
+	if (found != cur.regs.end()) {
+		*s = found->second;
+		return true;
+	}
+	// Reading a register before assigning it would carry a value from one
+	// iteration to the next.
+	if (reg >= assigned.size() || assigned[reg]) return false;
+	auto uniform = uniforms.find(reg);
+	if (uniform != uniforms.end()) {
+		*s = uniform->second;
+		return true;
+	}
+	operand o;
+	o.constant = false;
+	o.index = reg;
+	*s = emit(op::uniform, out.uniforms.size());
+	out.uniforms.push_back(o);
+	uniforms[reg] = *s;
+	return true;
+}
+
+bool converter::invariant(unsigned s) const {
+	return out.steps[s].code == op::constant ||
+			out.steps[s].code == op::uniform;
+}
+
+unsigned converter::invert(unsigned s) {
+	return emit(op::inv, s, 0, 0, out.steps[s].mask);
+}
+
+unsigned converter::nonzero(unsigned s) {
+	if (out.steps[s].mask) return s;
+	return invert(emit(op::eq, s, constant(0), 0, true));
+}
+
+unsigned converter::both(unsigned lanes, unsigned mask) {
+	return lanes == all? mask: emit(op::band, lanes, mask, 0, true);
+}
+
+unsigned converter::except(unsigned lanes, unsigned mask) {
+	if (lanes == all) return invert(mask);
+	return emit(op::andnot, mask, lanes, 0, true);
+}
+
+bool converter::branch(size_t from, size_t to, const path &p) {
+	if (to <= from || to > end) return false;
+	pending[to].push_back(p);
+	return true;
+}
+
+void converter::join(size_t pc) {
+	auto found = pending.find(pc);
+	if (found == pending.end()) return;
+	for (auto &p: found->second) {
+		if (!live) {
+			cur = p;
+			live = true;
+			continue;
+		}
+		// A register assigned on only one of the paths has no value here.
+		registers regs;
+		for (auto &r: cur.regs) {
+			auto other = p.regs.find(r.first);
+			if (other == p.regs.end()) continue;
+			if (other->second == r.second) {
+				regs.insert(r);
+				continue;
+			}
+			bool mask = out.steps[other->second].mask &&
+					out.steps[r.second].mask;
+			regs[r.first] =
+					emit(op::select, p.lanes, other->second, r.second, mask);
+		}
+		if (cur.lanes != all && p.lanes != all) {
+			cur.lanes = emit(op::bor, p.lanes, cur.lanes, 0, true);
+		} else {
+			cur.lanes = all;
+		}
+		cur.regs.swap(regs);
+	}
+	pending.erase(found);
+}
+
+bool converter::arithmetic(const instr &i) {
+	using namespace bytecode;
+	bool immediate = i.op >= addi && i.op <= nlti;
+	if (!immediate && (i.op < add || i.op > nlt)) return false;
+	unsigned x, y;
+	if (!get(i.b, &x)) return false;
+	if (immediate) {
+		y = constant(int16_t(i.c));
+	} else if (!get(i.c, &y)) {
+		return false;
+	}
+	bool masks = out.steps[x].mask && out.steps[y].mask;
+	unsigned r;
+	switch (i.op) {
+		case add: case addi: r = emit(simd::op::add, x, y); break;
+		case sub: case subi: r = emit(simd::op::sub, x, y); break;
+		case mul: case muli: r = emit(simd::op::mul, x, y); break;
+		// There is no division by lanes, nor shifting by them.
+		case bytecode::div: case divi:
+			if (!invariant(y)) return false;
+			r = emit(simd::op::div, x, y);
+			break;
+		case rem: case remi:
+			if (!invariant(y)) return false;
+			r = emit(simd::op::rem, x, y);
+			break;
+		case shl: case shli:
+			if (!invariant(y)) return false;
+			r = emit(simd::op::shl, x, y);
+			break;
+		case shr: case shri:
+			if (!invariant(y)) return false;
+			r = emit(simd::op::shr, x, y);
+			break;
+		case band: case bandi: r = emit(simd::op::band, x, y, 0, masks); break;
+		case bor: r = emit(simd::op::bor, x, y, 0, masks); break;
+		case bxor: r = emit(simd::op::bxor, x, y, 0, masks); break;
+		case bnand:
+			r = invert(emit(simd::op::band, x, y, 0, masks));
+			break;
+		case bnor:
+			r = invert(emit(simd::op::bor, x, y, 0, masks));
+			break;
+		case bxnor:
+			r = invert(emit(simd::op::bxor, x, y, 0, masks));
+			break;
+		case eq: case eqi: r = emit(simd::op::eq, x, y, 0, true); break;
+		case gt: case gti: r = emit(simd::op::gt, x, y, 0, true); break;
+		case lt: case lti: r = emit(simd::op::lt, x, y, 0, true); break;
+		case neq: case neqi:
+			r = invert(emit(simd::op::eq, x, y, 0, true));
+			break;
+		case ngt: case ngti:
+			r = invert(emit(simd::op::gt, x, y, 0, true));
+			break;
+		case nlt: case nlti:
+			r = invert(emit(simd::op::lt, x, y, 0, true));
+			break;
+		default: return false;
+	}
+	cur.regs[i.a] = r;
+	return true;
+}
+
+bool converter::translate(const instr &i, size_t pc) {
+	unsigned x, y;
+	switch (i.op) {
+		case bytecode::nop: return true;
+		case bytecode::integer:
+			cur.regs[i.a] = constant(int16_t(i.c));
+			return true;
+		case bytecode::load: {
+			const bytecode::constant &k = prog.constants[i.b];
+			if (!k.bytes) {
+				cur.regs[i.a] = constant(k.integer);
+				return true;
+			}
+			operand o;
+			o.constant = true;
+			o.index = i.b;
+			cur.regs[i.a] = emit(op::uniform, out.uniforms.size());
+			out.uniforms.push_back(o);
+			return true;
+		}
+		case bytecode::move:
+			if (!get(i.b, &x)) return false;
+			cur.regs[i.a] = x;
+			return true;
+		case bytecode::neg:
+			if (!get(i.b, &x)) return false;
+			cur.regs[i.a] = emit(op::neg, x);
+			return true;
+		case bytecode::inv:
+			if (!get(i.b, &x)) return false;
+			cur.regs[i.a] = invert(x);
+			return true;
+		case bytecode::apply:
+			// Only byte tables can be applied within lanes.
+			if (i.n != 1 || !get(i.b, &x) || !get(i.c, &y)) return false;
+			if (out.steps[x].code != op::uniform) return false;
+			cur.regs[i.a] = emit(op::lookup, x, y, cur.lanes);
+			return true;
+		case bytecode::jump:
+			live = false;
+			return branch(pc, i.b, cur);
+		case bytecode::jumpif: case bytecode::jumpnot: {
+			if (!get(i.a, &x)) return false;
+			unsigned mask = nonzero(x);
+			bool taken = i.op == bytecode::jumpif;
+			path other = cur;
+			other.lanes = taken? both(cur.lanes, mask): except(cur.lanes, mask);
+			cur.lanes = taken? except(cur.lanes, mask): both(cur.lanes, mask);
+			return branch(pc, i.b, other);
+		}
+		default: return arithmetic(i);
+	}
+}
+
+bool converter::convert(size_t top, size_t end, unsigned item, unsigned value) {
+	this->end = end;
+	all = constant(-1);
+	cur.lanes = all;
+	cur.regs[item] = emit(op::input, 0);
+	for (size_t pc = top + 1; pc < end; ++pc) {
+		join(pc);
+		if (live && !translate(fn.code[pc], pc)) return false;
+	}
+	join(end);
+	return live && get(value, &out.result);
+}
+
+} // namespace
+
+bool simd::compile(const bytecode::program &p, const bytecode::function &fn,
+		size_t pc, kernel *k) {
+	using namespace bytecode;
+	// The loop must be laid out as the compiler fuses maps:
+	//	vector buf, src, index
+	//	jump test
+	// top:	element item, src, index
+	//	...
+	//	store buf, index, value
+	//	addi index, index, 1
+	// test:	lt flag, index, count
+	//	jumpif flag, top
+	auto &code = fn.code;
+	if (pc + 2 >= code.size() || code[pc + 1].op != jump) return false;
+	const instr &v = code[pc];
+	size_t top = pc + 2, test = code[pc + 1].b;
+	if (test < top + 3 || test + 1 >= code.size()) return false;
+	const instr &first = code[top], &put = code[test - 2];
+	const instr &next = code[test - 1], &cmp = code[test];
+	const instr &back = code[test + 1];
+	if (first.op != element || first.b != v.b || first.c != v.c) return false;
+	if (put.op != store || put.a != v.a || put.b != v.c) return false;
+	if (next.op != addi || next.a != v.c || next.b != v.c || next.c != 1) {
+		return false;
+	}
+	if (cmp.op != lt || cmp.b != v.c) return false;
+	if (back.op != jumpif || back.a != cmp.a || back.b != top) return false;
+
+	kernel out;
+	converter c(p, fn, out);
+	for (size_t i = top; i <= test + 1; ++i) {
+		switch (code[i].op) {
+			case nop: case vector: case store: case setglobal: case jump:
+			case jumpif: case jumpnot: case ret:
+				continue;
+			default: break;
+		}
+		unsigned reg = code[i].a;
+		if (i > top && i < test - 2) {
+			if (reg == v.a || reg == v.b || reg == cmp.c) return false;
+		}
+		if (reg >= fn.registers) return false;
+		c.assign(reg);
+	}
+	if (!c.convert(top, test - 2, first.a, put.c)) return false;
+
+	// Only what the stored value depends on needs computing, but every
+	// lookup stays, since one out of range must stop the kernel.
+	std::vector<bool> needed(out.steps.size(), false);
+	needed[out.result] = true;
+	for (size_t s = out.steps.size(); s-- > 0;) {
+		const step &x = out.steps[s];
+		if (x.code == simd::op::lookup) needed[s] = true;
+		if (!needed[s]) continue;
+		unsigned n = arity(x.code);
+		if (n > 0) needed[x.a] = true;
+		if (n > 1) needed[x.b] = true;
+		if (n > 2) needed[x.c] = true;
+	}
+	std::vector<unsigned> index(out.steps.size());
+	k->steps.clear();
+	for (size_t s = 0; s < out.steps.size(); ++s) {
+		if (!needed[s]) continue;
+		step x = out.steps[s];
+		x.a = index[x.a];
+		x.b = index[x.b];
+		x.c = index[x.c];
+		if (x.code == simd::op::uniform) x.a = out.steps[s].a;
+		index[s] = k->steps.size();
+		k->steps.push_back(x);
+	}
+	k->uniforms = out.uniforms;
+	k->result = index[out.result];
+	return true;
+}
+
+size_t simd::run(const kernel &k, const std::vector<binding> &uniforms,
+		const uint8_t *src, uint8_t *dst, size_t count) {
+	if (count < tile) return 0;
+	// Bound the lanes of every step, given the uniforms' values; lanes a
+	// lookup's mask excludes hold garbage, which never reaches the output.
+	size_t n = k.steps.size();
+	std::vector<task> tasks(n);
+	std::vector<int64_t> lo(n), hi(n);
+	std::vector<bool> tables(n, false);
+	for (size_t s = 0; s < n; ++s) {
+		const step &x = k.steps[s];
+		task &t = tasks[s];
+		t.code = x.code;
+		t.a = x.a;
+		t.b = x.b;
+		t.c = x.c;
+		unsigned args = arity(x.code);
+		if (args > 0 && tables[x.a] && x.code != op::lookup) return 0;
+		if (args > 1 && tables[x.b]) return 0;
+		if (args > 2 && tables[x.c]) return 0;
+		int64_t l = 0, h = 0;
+		switch (x.code) {
+			case op::input: h = 255; break;
+			case op::constant: l = h = x.value; break;
+			case op::uniform:
+				if (uniforms[x.a].table) {
+					tables[s] = true;
+				} else {
+					l = h = uniforms[x.a].integer;
+				}
+				break;
+			case op::add:
+				l = lo[x.a] + lo[x.b];
+				h = hi[x.a] + hi[x.b];
+				break;
+			case op::sub:
+				l = lo[x.a] - hi[x.b];
+				h = hi[x.a] - lo[x.b];
+				break;
+			case op::mul: {
+				int64_t c[] = {lo[x.a] * lo[x.b], lo[x.a] * hi[x.b],
+						hi[x.a] * lo[x.b], hi[x.a] * hi[x.b]};
+				l = *std::min_element(c, c + 4);
+				h = *std::max_element(c, c + 4);
+				break;
+			}
+			case op::div: case op::rem: {
+				int64_t d = lo[x.b];
+				if (!d || d == INT16_MIN) return 0;
+				t.value = d;
+				if (d < -1 || d > 1) reciprocal(d, &t.magic, &t.bits);
+				if (x.code == op::div) {
+					l = std::min(lo[x.a] / d, hi[x.a] / d);
+					h = std::max(lo[x.a] / d, hi[x.a] / d);
+				} else {
+					int64_t m = (d < 0? -d: d) - 1;
+					l = lo[x.a] < 0? std::max(lo[x.a], -m): 0;
+					h = hi[x.a] > 0? std::min(hi[x.a], m): 0;
+				}
+				break;
+			}
+			case op::shl: {
+				int64_t bits = lo[x.b] & 63;
+				if (bits > 15) return 0;
+				t.value = bits;
+				l = lo[x.a] * (int64_t(1) << bits);
+				h = hi[x.a] * (int64_t(1) << bits);
+				break;
+			}
+			case op::shr: {
+				int64_t bits = std::min<int64_t>(lo[x.b] & 63, 15);
+				t.value = bits;
+				l = lo[x.a] >> bits;
+				h = hi[x.a] >> bits;
+				break;
+			}
+			case op::band: case op::bor: case op::bxor: case op::andnot: {
+				// Bitwise results of 16-bit operands fit in 16 bits; only
+				// non-negative ones are worth bounding more closely.
+				l = INT16_MIN;
+				h = INT16_MAX;
+				bool left = lo[x.a] >= 0, right = lo[x.b] >= 0;
+				int64_t top = std::max(hi[x.a], hi[x.b]), ceiling = 1;
+				while (ceiling <= top) ceiling <<= 1;
+				if (x.mask) {
+					l = -1;
+					h = 0;
+				} else if (x.code == op::band && (left || right)) {
+					l = 0;
+					h = left && right? std::min(hi[x.a], hi[x.b]):
+							left? hi[x.a]: hi[x.b];
+				} else if (x.code == op::andnot && right) {
+					l = 0;
+					h = hi[x.b];
+				} else if (x.code != op::andnot && left && right) {
+					l = 0;
+					h = ceiling - 1;
+				}
+				break;
+			}
+			case op::inv:
+				l = ~hi[x.a];
+				h = ~lo[x.a];
+				break;
+			case op::neg:
+				l = -hi[x.a];
+				h = -lo[x.a];
+				break;
+			case op::eq: case op::gt: case op::lt: l = -1; break;
+			case op::select:
+				l = std::min(lo[x.b], lo[x.c]);
+				h = std::max(hi[x.b], hi[x.c]);
+				break;
+			case op::lookup: {
+				if (!tables[x.a]) return 0;
+				const binding &u = uniforms[k.steps[x.a].a];
+				size_t length = std::min<size_t>(u.length, INT16_MAX + 1);
+				t.table = u.table;
+				t.last = int64_t(length) - 1;
+				t.check = lo[x.b] < 0 || hi[x.b] > t.last;
+				if (length) {
+					l = *std::min_element(u.table, u.table + length);
+					h = *std::max_element(u.table, u.table + length);
+				}
+				// Tables like the alphabet need no lookup at all.
+				t.linear = length > 0;
+				int stride = length > 1? u.table[1] - u.table[0]: 0;
+				for (size_t i = 1; t.linear && i < length; ++i) {
+					t.linear = u.table[i] - u.table[i - 1] == stride;
+				}
+				t.base = length? u.table[0]: 0;
+				t.stride = stride;
+				break;
+			}
+		}
+		if (l < INT16_MIN || h > INT16_MAX) return 0;
+		lo[s] = l;
+		hi[s] = h;
+		if (x.code == op::constant || x.code == op::uniform) t.value = l;
+	}
+	if (tables[k.result]) return 0;
+	bool check = lo[k.result] < 0 || hi[k.result] > 255;
+	std::vector<int16_t> storage(n * tile + 16);
+	uintptr_t base = reinterpret_cast<uintptr_t>(storage.data());
+	int16_t *slots = reinterpret_cast<int16_t*>((base + 31) & ~uintptr_t(31));
+#if defined(__x86_64__) && defined(__GNUC__)
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+#else
+	static const bool avx2 = false;
+#endif
+	if (avx2) {
+		return run_avx2(tasks.data(), n, k.result, check,
+				slots, src, dst, count);
+	}
+	return run_sse2(tasks.data(), n, k.result, check, slots, src, dst, count);
+}
@@ -0,0 +1,77 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "bytecode.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Element-wise kernels over byte arrays. The body of a fused map loop which
+// branches only forward is if-converted into a straight-line program over
+// lanes of signed 16-bit integers, which runs a whole vector at a time.
+namespace simd {
+
+// Comparisons yield -1 or 0 in each lane, as booleans do in the language.
+enum class op: uint8_t {
+	input, // the element being mapped
+	constant, // 'value' in every lane
+	uniform, // loop-invariant operand 'a', which may also be a byte table
+	add, sub, mul,
+	div, rem, shl, shr, // by the constant or uniform in step 'b'
+	band, bor, bxor,
+	andnot, // ~a & b
+	inv, neg,
+	eq, gt, lt,
+	select, // a? b: c
+	lookup, // element b of uniform table a, for lanes where mask c is set
+};
+
+struct step {
+	op code;
+	unsigned a = 0;
+	unsigned b = 0;
+	unsigned c = 0;
+	int64_t value = 0;
+	bool mask = false; // every lane is known to be -1 or 0
+};
+
+// A register of the function running the loop, or a program constant.
+struct operand {
+	bool constant;
+	unsigned index;
+};
+
+struct kernel {
+	std::vector<step> steps;
+	std::vector<operand> uniforms;
+	unsigned result = 0; // the step whose lanes are stored
+};
+
+// Compiles the loop following the 'vector' instruction at 'pc', if its body
+// can be expressed in lanes.
+bool compile(const bytecode::program&, const bytecode::function&,
+		size_t pc, kernel*);
+
+// The value of a uniform for one run: an integer, or a byte table.
+struct binding {
+	int64_t integer = 0;
+	const uint8_t *table = nullptr;
+	size_t length = 0;
+};
+
+// Maps whole tiles of 'src' into 'dst' and returns the count of elements
+// done, leaving the rest to the scalar loop. Nothing runs unless every lane
+// provably fits in 16 bits; a tile where some lane would index a table out
+// of range or store a value other than a byte stops the run.
+size_t run(const kernel&, const std::vector<binding>&,
+		const uint8_t *src, uint8_t *dst, size_t count);
+
+} // namespace simd
+
+#endif //SIMD_H
@@ -0,0 +1,83 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+// Everything in this file may use AVX2; it is only called after checking
+// that the processor supports it.
+#if defined(__x86_64__) && defined(__GNUC__)
+#pragma GCC target("avx2")
+#define SIMD_AVX2
+#endif
+
+#include "simd_lanes.h"
+
+#ifdef SIMD_AVX2
+#include <immintrin.h>
+
+namespace {
+
+struct avx2 {
+	typedef __m256i vector;
+	static const size_t width = 16;
+	static vector splat(int16_t x) { return _mm256_set1_epi16(x); }
+	static vector load(const int16_t *p) {
+		return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+	}
+	static void store(int16_t *p, vector v) {
+		_mm256_store_si256(reinterpret_cast<__m256i*>(p), v);
+	}
+	static vector expand(const uint8_t *p) {
+		return _mm256_cvtepu8_epi16(
+				_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+	}
+	// Packing works within each 128-bit half, so the quarters are put back
+	// in order afterward.
+	static void narrow(uint8_t *p, vector lo, vector hi) {
+		vector bytes = _mm256_packus_epi16(lo, hi);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(p),
+				_mm256_permute4x64_epi64(bytes, 0xD8));
+	}
+	static vector add(vector a, vector b) { return _mm256_add_epi16(a, b); }
+	static vector sub(vector a, vector b) { return _mm256_sub_epi16(a, b); }
+	static vector mul(vector a, vector b) {
+		return _mm256_mullo_epi16(a, b);
+	}
+	static vector mulhi(vector a, vector b) {
+		return _mm256_mulhi_epi16(a, b);
+	}
+	static vector sign(vector a) { return _mm256_srli_epi16(a, 15); }
+	static vector shl(vector a, int n) {
+		return _mm256_sll_epi16(a, _mm_cvtsi32_si128(n));
+	}
+	static vector shr(vector a, int n) {
+		return _mm256_sra_epi16(a, _mm_cvtsi32_si128(n));
+	}
+	static vector band(vector a, vector b) { return _mm256_and_si256(a, b); }
+	static vector bor(vector a, vector b) { return _mm256_or_si256(a, b); }
+	static vector bxor(vector a, vector b) { return _mm256_xor_si256(a, b); }
+	static vector andnot(vector a, vector b) {
+		return _mm256_andnot_si256(a, b);
+	}
+	static vector eq(vector a, vector b) { return _mm256_cmpeq_epi16(a, b); }
+	static vector gt(vector a, vector b) { return _mm256_cmpgt_epi16(a, b); }
+	static bool any(vector a) { return _mm256_movemask_epi8(a) != 0; }
+};
+
+} // namespace
+
+size_t simd::run_avx2(const task *tasks, size_t n, unsigned result,
+		bool check, int16_t *slots, const uint8_t *src, uint8_t *dst,
+		size_t count) {
+	return lanes<avx2>(tasks, n, result, check, slots, src, dst, count);
+}
+
+#else
+
+size_t simd::run_avx2(const task*, size_t, unsigned, bool, int16_t*,
+		const uint8_t*, uint8_t*, size_t) {
+	return 0;
+}
+
+#endif //SIMD_AVX2
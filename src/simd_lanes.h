@@ -0,0 +1,162 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef SIMD_LANES_H
+#define SIMD_LANES_H
+
+#include "simd.h"
+
+// Kernel interpreter shared by the instruction set back ends. Each of them
+// instantiates it with a traits class wrapping its intrinsics, in its own
+// translation unit, so that only the code which needs them is compiled for
+// the wider instruction sets.
+namespace simd {
+
+// Elements per tile. Each step runs across a whole tile before the next
+// begins, which keeps the cost of interpreting the steps off the lanes.
+static const size_t tile = 256;
+
+// A step with its operands resolved for one run of the kernel.
+struct task {
+	op code;
+	bool check = false; // lookup indexes must be range checked
+	bool linear = false; // lookup table is an arithmetic progression
+	unsigned a = 0;
+	unsigned b = 0;
+	unsigned c = 0;
+	int16_t value = 0; // broadcast value, divisor, or shift count
+	int16_t magic = 0; // multiplier and shift dividing by 'value'
+	int16_t bits = 0;
+	int16_t last = 0; // highest index of the lookup table, saturated
+	int16_t base = 0;
+	int16_t stride = 0;
+	const uint8_t *table = nullptr;
+};
+
+size_t run_sse2(const task*, size_t n, unsigned result, bool check,
+		int16_t *slots, const uint8_t *src, uint8_t *dst, size_t count);
+size_t run_avx2(const task*, size_t n, unsigned result, bool check,
+		int16_t *slots, const uint8_t *src, uint8_t *dst, size_t count);
+
+// Divides by a constant, multiplying by its reciprocal as Hacker's Delight
+// describes; the task has computed the magic number.
+template<class isa>
+typename isa::vector quotient(const task &t, typename isa::vector a) {
+	typedef typename isa::vector vector;
+	if (t.value == 1) return a;
+	if (t.value == -1) return isa::sub(isa::splat(0), a);
+	vector q = isa::mulhi(a, isa::splat(t.magic));
+	if (t.value > 0 && t.magic < 0) q = isa::add(q, a);
+	if (t.value < 0 && t.magic > 0) q = isa::sub(q, a);
+	q = isa::shr(q, t.bits);
+	return isa::add(q, isa::sign(q));
+}
+
+// Slots hold one tile of lanes per task and must be aligned to 32 bytes.
+template<class isa>
+size_t lanes(const task *tasks, size_t n, unsigned result, bool check,
+		int16_t *slots, const uint8_t *src, uint8_t *dst, size_t count) {
+	typedef typename isa::vector vector;
+	const size_t per = tile / isa::width;
+	auto slot = [slots](unsigned index) {
+		return reinterpret_cast<vector*>(slots + index * tile);
+	};
+	for (size_t k = 0; k < n; ++k) {
+		if (tasks[k].code == op::constant || tasks[k].code == op::uniform) {
+			vector *out = slot(k);
+			for (size_t j = 0; j < per; ++j) {
+				out[j] = isa::splat(tasks[k].value);
+			}
+		}
+	}
+	const vector zero = isa::splat(0), byte = isa::splat(255);
+	size_t done = 0;
+	for (; count - done >= tile; done += tile) {
+		for (size_t k = 0; k < n; ++k) {
+			const task &t = tasks[k];
+			vector *out = slot(k);
+			const vector *a = slot(t.a), *b = slot(t.b), *c = slot(t.c);
+#define LANES(expr) \
+			for (size_t j = 0; j < per; ++j) { \
+				out[j] = (expr); \
+			} \
+			break;
+			switch (t.code) {
+				case op::constant: case op::uniform: break;
+				case op::input:
+					LANES(isa::expand(src + done + j * isa::width))
+				case op::add: LANES(isa::add(a[j], b[j]))
+				case op::sub: LANES(isa::sub(a[j], b[j]))
+				case op::mul: LANES(isa::mul(a[j], b[j]))
+				case op::div: LANES(quotient<isa>(t, a[j]))
+				case op::rem:
+					LANES(isa::sub(a[j], isa::mul(
+							quotient<isa>(t, a[j]), isa::splat(t.value))))
+				case op::shl: LANES(isa::shl(a[j], t.value))
+				case op::shr: LANES(isa::shr(a[j], t.value))
+				case op::band: LANES(isa::band(a[j], b[j]))
+				case op::bor: LANES(isa::bor(a[j], b[j]))
+				case op::bxor: LANES(isa::bxor(a[j], b[j]))
+				case op::andnot: LANES(isa::andnot(a[j], b[j]))
+				case op::inv: LANES(isa::bxor(a[j], isa::splat(-1)))
+				case op::neg: LANES(isa::sub(zero, a[j]))
+				case op::eq: LANES(isa::eq(a[j], b[j]))
+				case op::gt: LANES(isa::gt(a[j], b[j]))
+				case op::lt: LANES(isa::gt(b[j], a[j]))
+				case op::select:
+					LANES(isa::bor(
+							isa::band(a[j], b[j]), isa::andnot(a[j], c[j])))
+				case op::lookup: {
+					const vector last = isa::splat(t.last);
+					if (t.check) {
+						vector bad = zero;
+						for (size_t j = 0; j < per; ++j) {
+							vector range = isa::bor(isa::gt(zero, b[j]),
+									isa::gt(b[j], last));
+							bad = isa::bor(bad, isa::band(c[j], range));
+						}
+						if (isa::any(bad)) return done;
+					}
+					if (t.linear) {
+						const vector base = isa::splat(t.base);
+						const vector stride = isa::splat(t.stride);
+						LANES(isa::add(base, isa::mul(b[j], stride)))
+					}
+					// Without a gather for bytes, lanes are looked up one
+					// at a time; lanes outside the mask may be garbage.
+					alignas(32) int16_t lane[isa::width];
+					for (size_t j = 0; j < per; ++j) {
+						isa::store(lane, b[j]);
+						for (size_t l = 0; l < isa::width; ++l) {
+							int16_t x = lane[l];
+							lane[l] = x >= 0 && x <= t.last? t.table[x]: 0;
+						}
+						out[j] = isa::load(lane);
+					}
+					break;
+				}
+			}
+#undef LANES
+		}
+		const vector *r = slot(result);
+		if (check) {
+			vector bad = zero;
+			for (size_t j = 0; j < per; ++j) {
+				bad = isa::bor(bad, isa::bor(
+						isa::gt(zero, r[j]), isa::gt(r[j], byte)));
+			}
+			if (isa::any(bad)) return done;
+		}
+		for (size_t j = 0; j < per; j += 2) {
+			isa::narrow(dst + done + j * isa::width, r[j], r[j + 1]);
+		}
+	}
+	return done;
+}
+
+} // namespace simd
+
+#endif //SIMD_LANES_H
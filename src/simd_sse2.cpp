@@ -0,0 +1,70 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "simd_lanes.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+namespace {
+
+struct sse2 {
+	typedef __m128i vector;
+	static const size_t width = 8;
+	static vector splat(int16_t x) { return _mm_set1_epi16(x); }
+	static vector load(const int16_t *p) {
+		return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+	}
+	static void store(int16_t *p, vector v) {
+		_mm_store_si128(reinterpret_cast<__m128i*>(p), v);
+	}
+	static vector expand(const uint8_t *p) {
+		vector bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+		return _mm_unpacklo_epi8(bytes, _mm_setzero_si128());
+	}
+	static void narrow(uint8_t *p, vector lo, vector hi) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p),
+				_mm_packus_epi16(lo, hi));
+	}
+	static vector add(vector a, vector b) { return _mm_add_epi16(a, b); }
+	static vector sub(vector a, vector b) { return _mm_sub_epi16(a, b); }
+	static vector mul(vector a, vector b) { return _mm_mullo_epi16(a, b); }
+	static vector mulhi(vector a, vector b) { return _mm_mulhi_epi16(a, b); }
+	// 1 in lanes which are negative, else 0.
+	static vector sign(vector a) { return _mm_srli_epi16(a, 15); }
+	static vector shl(vector a, int n) {
+		return _mm_sll_epi16(a, _mm_cvtsi32_si128(n));
+	}
+	static vector shr(vector a, int n) {
+		return _mm_sra_epi16(a, _mm_cvtsi32_si128(n));
+	}
+	static vector band(vector a, vector b) { return _mm_and_si128(a, b); }
+	static vector bor(vector a, vector b) { return _mm_or_si128(a, b); }
+	static vector bxor(vector a, vector b) { return _mm_xor_si128(a, b); }
+	static vector andnot(vector a, vector b) {
+		return _mm_andnot_si128(a, b);
+	}
+	static vector eq(vector a, vector b) { return _mm_cmpeq_epi16(a, b); }
+	static vector gt(vector a, vector b) { return _mm_cmpgt_epi16(a, b); }
+	static bool any(vector a) { return _mm_movemask_epi8(a) != 0; }
+};
+
+} // namespace
+
+size_t simd::run_sse2(const task *tasks, size_t n, unsigned result,
+		bool check, int16_t *slots, const uint8_t *src, uint8_t *dst,
+		size_t count) {
+	return lanes<sse2>(tasks, n, result, check, slots, src, dst, count);
+}
+
+#else
+
+size_t simd::run_sse2(const task*, size_t, unsigned, bool, int16_t*,
+		const uint8_t*, uint8_t*, size_t) {
+	return 0;
+}
+
+#endif //__SSE2__
@@ -0,0 +1,263 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+using namespace runtime;
+
+pool &pool::shared() {
+	static pool instance;
+	return instance;
+}
+
+pool::~pool() {
+	for (auto buffer: spare) {
+		free(buffer);
+	}
+}
+
+uint8_t *pool::acquire() {
+	{
+		std::lock_guard<std::mutex> hold(lock);
+		if (!spare.empty()) {
+			uint8_t *out = spare.back();
+			spare.pop_back();
+			return out;
+		}
+	}
+	uint8_t *out = static_cast<uint8_t*>(malloc(size));
+	if (!out) abort();
+	return out;
+}
+
+void pool::release(uint8_t *buffer) {
+	std::lock_guard<std::mutex> hold(lock);
+	spare.push_back(buffer);
+}
+
+namespace {
+
+// Descriptors we did not open may have been left non-blocking.
+bool retry(int fd, short events) {
+	if (errno == EINTR) return true;
+	if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+	pollfd p = {fd, events, 0};
+	poll(&p, 1, -1);
+	return true;
+}
+
+class mapped: public source {
+public:
+	mapped(void *b, size_t l, size_t o):
+			base(static_cast<uint8_t*>(b)), length(l), offset(o) {}
+	~mapped() { munmap(base, length); }
+	size_t next(const uint8_t **data) override {
+		if (offset >= length) return 0;
+		*data = base + offset;
+		size_t out = length - offset;
+		offset = length;
+		return out;
+	}
+private:
+	uint8_t *base;
+	size_t length;
+	size_t offset;
+};
+
+class reader: public source {
+public:
+	reader(int f, bool o): fd(f), owned(o), buffer(pool::shared().acquire()) {}
+	~reader() {
+		pool::shared().release(buffer);
+		if (owned) close(fd);
+	}
+	size_t next(const uint8_t **data) override {
+		*data = buffer;
+		for (;;) {
+			ssize_t n = read(fd, buffer, pool::size);
+			if (n >= 0) return n;
+			if (!retry(fd, POLLIN)) break;
+		}
+		error = errno;
+		return 0;
+	}
+private:
+	int fd;
+	bool owned;
+	uint8_t *buffer;
+};
+
+class text: public source {
+public:
+	explicit text(const std::string &s): contents(s) {}
+	size_t next(const uint8_t **data) override {
+		if (done) return 0;
+		done = true;
+		*data = reinterpret_cast<const uint8_t*>(contents.data());
+		return contents.size();
+	}
+private:
+	std::string contents;
+	bool done = false;
+};
+
+// Maps a regular file from the descriptor's current position onward, and
+// moves that position to the end, as if it had all been read.
+std::unique_ptr<source> map(int fd) {
+	struct stat info;
+	if (fstat(fd, &info) || !S_ISREG(info.st_mode) || info.st_size <= 0) {
+		return nullptr;
+	}
+	off_t at = lseek(fd, 0, SEEK_CUR);
+	if (at < 0) at = 0;
+	size_t length = info.st_size;
+	void *base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) return nullptr;
+	madvise(base, length, MADV_SEQUENTIAL);
+	lseek(fd, 0, SEEK_END);
+	return std::unique_ptr<source>(new mapped(base, length, at));
+}
+
+// Writes every byte in the spans, however many calls that takes.
+bool drain(int fd, iovec *v, int count, int *error) {
+	while (count > 0) {
+		ssize_t n = writev(fd, v, count);
+		if (n < 0) {
+			if (retry(fd, POLLOUT)) continue;
+			*error = errno;
+			return false;
+		}
+		while (count > 0 && size_t(n) >= v->iov_len) {
+			n -= v->iov_len;
+			++v;
+			--count;
+		}
+		if (count > 0) {
+			v->iov_base = static_cast<uint8_t*>(v->iov_base) + n;
+			v->iov_len -= n;
+		}
+	}
+	return true;
+}
+
+} // namespace
+
+std::unique_ptr<source> runtime::open_source(const std::string &path) {
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) return nullptr;
+	std::unique_ptr<source> out = map(fd);
+	if (out) {
+		close(fd);
+		return out;
+	}
+	return std::unique_ptr<source>(new reader(fd, true));
+}
+
+std::unique_ptr<source> runtime::fd_source(int fd) {
+	std::unique_ptr<source> out = map(fd);
+	if (out) return out;
+	return std::unique_ptr<source>(new reader(fd, false));
+}
+
+std::unique_ptr<source> runtime::string_source(const std::string &s) {
+	return std::unique_ptr<source>(new text(s));
+}
+
+sink::sink(int f): fd(f), buffer(pool::shared().acquire()) {
+}
+
+sink::~sink() {
+	flush();
+	pool::shared().release(buffer);
+}
+
+bool sink::write(const uint8_t *data, size_t bytes) {
+	// Copying a large write would cost more than the system call it saves.
+	if (bytes >= pool::size / 4) return gather(data, bytes);
+	if (used + bytes > pool::size && !flush()) return false;
+	memcpy(buffer + used, data, bytes);
+	used += bytes;
+	return true;
+}
+
+bool sink::flush() {
+	return gather(nullptr, 0);
+}
+
+bool sink::gather(const uint8_t *data, size_t bytes) {
+	iovec v[2];
+	int count = 0;
+	if (used) {
+		v[count].iov_base = buffer;
+		v[count++].iov_len = used;
+	}
+	if (bytes) {
+		v[count].iov_base = const_cast<uint8_t*>(data);
+		v[count++].iov_len = bytes;
+	}
+	used = 0;
+	return !error && drain(fd, v, count, &error);
+}
+
+bool runtime::transfer(int from, int to) {
+#ifdef __linux__
+	// Each of these fails at once, with nothing moved, when the kernel
+	// cannot connect this pair of descriptors.
+	struct stat info;
+	bool file = !fstat(from, &info) && S_ISREG(info.st_mode);
+	bool moved = false;
+	for (;;) {
+		ssize_t n = file?
+				sendfile(to, from, nullptr, 1 << 30):
+				splice(from, nullptr, to, nullptr, 1 << 20, SPLICE_F_MORE);
+		if (n > 0) {
+			moved = true;
+			continue;
+		}
+		if (n == 0) return true;
+		if (errno == EAGAIN) {
+			// Either end might be the one which is not ready.
+			pollfd p[2] = {{from, POLLIN, 0}, {to, POLLOUT, 0}};
+			poll(p, 2, -1);
+			continue;
+		}
+		if (errno == EINTR) continue;
+		if (moved || (errno != EINVAL && errno != ENOSYS)) return false;
+		break;
+	}
+#endif
+	uint8_t *buffer = pool::shared().acquire();
+	bool ok = true;
+	for (;;) {
+		ssize_t n = read(from, buffer, pool::size);
+		if (n < 0) {
+			if (retry(from, POLLIN)) continue;
+			ok = false;
+			break;
+		}
+		if (n == 0) break;
+		iovec v = {buffer, size_t(n)};
+		int error = 0;
+		if (!drain(to, &v, 1, &error)) {
+			ok = false;
+			break;
+		}
+	}
+	pool::shared().release(buffer);
+	return ok;
+}
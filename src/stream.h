@@ -0,0 +1,77 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <memory>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace runtime {
+
+// Fixed-size I/O buffers, recycled rather than freed, so that a stream
+// which keeps opening and closing does not keep going back to malloc.
+class pool {
+public:
+	static const size_t size = 1 << 16;
+	static pool &shared();
+	~pool();
+	uint8_t *acquire();
+	void release(uint8_t*);
+private:
+	std::mutex lock;
+	std::vector<uint8_t*> spare;
+};
+
+// A stream of input bytes, delivered a span at a time without copying
+// where the source allows it.
+class source {
+public:
+	virtual ~source() {}
+	// Yields the next span, which stays valid until the following call;
+	// an empty span marks the end.
+	virtual size_t next(const uint8_t **data) = 0;
+	bool failed() const { return error != 0; }
+	int error = 0; // errno of the failure which ended the stream, if any
+};
+
+// Regular files are mapped into memory and arrive as a single span; other
+// descriptors are read into pooled buffers. These return null, with errno
+// set, if the file cannot be opened.
+std::unique_ptr<source> open_source(const std::string &path);
+std::unique_ptr<source> fd_source(int fd);
+std::unique_ptr<source> string_source(const std::string&);
+
+// Buffered output to a descriptor. Small writes are gathered into a pooled
+// buffer; a large one goes straight from the caller's memory, together with
+// whatever was buffered, in one writev.
+class sink {
+public:
+	explicit sink(int fd);
+	sink(const sink&) = delete;
+	~sink();
+	bool write(const uint8_t *data, size_t bytes);
+	bool flush();
+	int error = 0;
+private:
+	bool gather(const uint8_t *data, size_t bytes);
+	int fd;
+	uint8_t *buffer;
+	size_t used = 0;
+};
+
+// Copies everything from one descriptor to another, using sendfile from a
+// regular file and splice to or from a pipe, so that the bytes never pass
+// through user space; it falls back on read and write when neither works.
+bool transfer(int from, int to);
+
+} // namespace runtime
+
+#endif //STREAM_H
@@ -13,7 +13,7 @@
 namespace syntax {
 enum branch {
 	apply, pipe, sequence, pair, range,
-	assign, capture, declare, define, typealias,
+	assign, capture, declare, define, typealias, macro,
 	and_join, or_join, xor_join, nand_join, nor_join, xnor_join,
 	add, sub, mul, div, rem, shl, shr, eq, gt, lt, neq, ngt, nlt
 };
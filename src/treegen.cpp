@@ -7,7 +7,11 @@
 #include "treegen.h"
 
 void treegen::emit_eof(location origin) {
-	store(new ast::eof(origin));
+	// The parser always closes the program with a single expression before
+	// it reports the end of input, so that expression is the complete tree.
+	while (!state.empty()) {
+		out.process(recall());
+	}
 }
 
 void treegen::emit_wildcard(location origin) {
@@ -31,8 +35,8 @@ void treegen::emit_identifier(std::string text, location origin) {
 }
 
 void treegen::emit_branch(syntax::branch id, std::string text, location o) {
-	ast::unique_ptr right = recall();
-	ast::unique_ptr left = recall();
+	ast::ptr right = recall();
+	ast::ptr left = recall();
 	switch (id) {
 		case syntax::apply:
 			store(new ast::apply(std::move(left), std::move(right), o));
@@ -64,20 +68,26 @@ void treegen::emit_branch(syntax::branch id, std::string text, location o) {
 		case syntax::typealias:
 			store(new ast::typealias(std::move(left), std::move(right), o));
 			break;
+		case syntax::macro:
+			store(new ast::macro(std::move(left), std::move(right), o));
+			break;
 		default:
-			store(new ast::binop(text, std::move(left), std::move(right), o));
+			store(new ast::binop(
+					id, text, std::move(left), std::move(right), o));
 			break;
 	}
 }
 
 void treegen::store(ast::node *n) {
-	ast::unique_ptr p(n);
-	out.process(std::move(p));
-	state.emplace(std::move(p));
+	if (cons) {
+		state.push((*cons)(n));
+	} else {
+		state.emplace(n);
+	}
 }
 
-ast::unique_ptr &&treegen::recall() {
-	ast::unique_ptr out = std::move(state.top());
+ast::ptr treegen::recall() {
+	ast::ptr out = std::move(state.top());
 	state.pop();
-	return std::move(out);
+	return out;
 }
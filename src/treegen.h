@@ -8,12 +8,16 @@
 #define TREEGEN_H
 
 #include "ast.h"
+#include "builder.h"
 #include "errors.h"
 #include "syntax.h"
 #include <stack>
 
+// Builds the tree from the parser's events. Given a builder, it shares each
+// repeated subtree instead of building it again.
 struct treegen: public syntax::delegate {
-	treegen(ast::delegate &o, errors &e): out(o), err(e) {}
+	treegen(ast::delegate &o, errors &e, ast::builder *b = nullptr):
+			out(o), err(e), cons(b) {}
 	virtual void emit_eof(location) override;
 	virtual void emit_wildcard(location) override;
 	virtual void emit_null(location) override;
@@ -23,10 +27,11 @@ struct treegen: public syntax::delegate {
 	virtual void emit_branch(syntax::branch, std::string, location) override;
 private:
 	void store(ast::node*);
-	ast::unique_ptr &&recall();
-	std::stack<ast::unique_ptr> state;
+	ast::ptr recall();
+	std::stack<ast::ptr> state;
 	ast::delegate &out;
 	errors &err;
+	ast::builder *cons;
 };
 
 #endif //TREEGEN_H
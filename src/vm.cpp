@@ -0,0 +1,693 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#include "vm.h"
+#include "profiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+using namespace vm;
+using bytecode::instr;
+
+static const size_t chunk_size = 1 << 20;
+
+heap::~heap() {
+	for (auto &c: chunks) {
+		free(c.base);
+	}
+	for (char *c: spare) {
+		free(c);
+	}
+}
+
+void *heap::allocate(size_t bytes) {
+	bytes = (bytes + 15) & ~size_t(15);
+	if (bytes > size_t(limit - next)) {
+		// Oversized requests get a chunk of their own, so the current chunk
+		// remains available for the small objects which follow.
+		size_t size = bytes > chunk_size / 4? bytes: chunk_size;
+		char *base = nullptr;
+		if (size == chunk_size && !spare.empty()) {
+			base = spare.back();
+			spare.pop_back();
+		} else {
+			base = static_cast<char*>(malloc(size));
+		}
+		if (!base) abort();
+		chunks.push_back(chunk{base, size});
+		if (size != chunk_size) {
+			return base;
+		}
+		next = base;
+		limit = base + size;
+	}
+	void *out = next;
+	next += bytes;
+	return out;
+}
+
+void heap::release(const mark &m) {
+	// Standard chunks are kept for reuse, since a region which is released
+	// is likely to be allocated again soon.
+	while (chunks.size() > m.chunks) {
+		chunk &c = chunks.back();
+		if (c.size == chunk_size) {
+			spare.push_back(c.base);
+		} else {
+			free(c.base);
+		}
+		chunks.pop_back();
+	}
+	next = m.next;
+	limit = m.limit;
+}
+
+blob *heap::make_blob(size_t length) {
+	blob *out = static_cast<blob*>(
+			allocate(offsetof(blob, data) + length));
+	out->length = length;
+	return out;
+}
+
+array *heap::make_array(size_t length) {
+	array *out = static_cast<array*>(
+			allocate(offsetof(array, items) + length * sizeof(value)));
+	out->length = length;
+	return out;
+}
+
+closure *heap::make_closure(unsigned function, unsigned count) {
+	closure *out = static_cast<closure*>(
+			allocate(offsetof(closure, env) + count * sizeof(value)));
+	out->function = function;
+	out->count = count;
+	return out;
+}
+
+machine::machine(const bytecode::program &p, errors &e): prog(p), err(e) {
+	for (auto &k: prog.constants) {
+		if (k.bytes) {
+			blob *b = memory.make_blob(k.bytes->size());
+			memcpy(b->data, k.bytes->data(), b->length);
+			constants.push_back(value(b));
+		} else {
+			constants.push_back(value(k.integer));
+		}
+	}
+	for (unsigned i = 0; i < prog.functions.size(); ++i) {
+		statics.push_back(memory.make_closure(i, 0));
+	}
+	for (auto &g: prog.globals) {
+		globals.push_back(g.function >= 0?
+				value(statics[g.function]): value());
+		states.push_back(g.init >= 0? status::pending: status::ready);
+	}
+	for (auto &fn: prog.functions) {
+		for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+			simd::kernel k;
+			if (fn.code[pc].op != bytecode::vector) continue;
+			if (!simd::compile(prog, fn, pc, &k)) continue;
+			kernels[&fn.code[pc]] = std::move(k);
+		}
+	}
+	frames.reserve(max_depth);
+	stack.resize(stack_size);
+}
+
+bool machine::start(value *result) {
+	if (!enter(statics[prog.init], nullptr, 0)) return false;
+	return execute(frames.size() - 1, result);
+}
+
+bool machine::global(const std::string &name, value *out) {
+	for (size_t i = 0; i < prog.globals.size(); ++i) {
+		if (prog.globals[i].name == name) {
+			if (!initialize(i)) return false;
+			*out = globals[i];
+			return true;
+		}
+	}
+	return false;
+}
+
+bool machine::initialize(unsigned index) {
+	switch (states[index]) {
+		case status::ready: return true;
+		case status::busy:
+			return fault("definition of '" + prog.globals[index].name +
+					"' depends on its own value");
+		case status::pending: break;
+	}
+	states[index] = status::busy;
+	value fn(statics[prog.globals[index].init]);
+	if (!call(fn, nullptr, 0, &globals[index])) return false;
+	states[index] = status::ready;
+	return true;
+}
+
+bool machine::call(
+		const value &fn, const value *args, unsigned n, value *result) {
+	switch (fn.type) {
+		case kind::closure: {
+			size_t depth = frames.size();
+			if (!enter(fn.c, args, n)) return false;
+			return execute(depth, result);
+		}
+		case kind::blob:
+			if (n != 1 || args[0].type != kind::integer) {
+				return fault("byte array index must be one integer");
+			}
+			if (uint64_t(args[0].i) >= fn.b->length) {
+				return fault("index out of range");
+			}
+			*result = value(int64_t(fn.b->data[args[0].i]));
+			return true;
+		case kind::array:
+			if (n != 1 || args[0].type != kind::integer) {
+				return fault("array index must be one integer");
+			}
+			if (uint64_t(args[0].i) >= fn.a->length) {
+				return fault("index out of range");
+			}
+			*result = fn.a->items[args[0].i];
+			return true;
+		case kind::integer:
+			// Booleans select the first of two alternatives when true.
+			if (n != 2) {
+				return fault("a boolean selects between two alternatives");
+			}
+			*result = args[fn.i? 0: 1];
+			return true;
+		default:
+			return fault("value cannot be applied");
+	}
+}
+
+array *machine::widen(const blob *bytes, size_t count) {
+	array *out = memory.make_array(bytes->length);
+	for (size_t i = 0; i < count; ++i) {
+		out->items[i] = value(int64_t(bytes->data[i]));
+	}
+	return out;
+}
+
+void machine::tiles(const instr &i, value *regs) {
+	auto found = kernels.find(&i);
+	if (found == kernels.end()) return;
+	const value &src = regs[i.b], &buf = regs[i.a];
+	if (src.type != kind::blob || buf.type != kind::blob) return;
+	const simd::kernel &k = found->second;
+	std::vector<simd::binding> uniforms(k.uniforms.size());
+	for (size_t u = 0; u < uniforms.size(); ++u) {
+		const simd::operand &o = k.uniforms[u];
+		const value &v = o.constant? constants[o.index]: regs[o.index];
+		if (v.type == kind::integer) {
+			uniforms[u].integer = v.i;
+		} else if (v.type == kind::blob) {
+			uniforms[u].table = v.b->data;
+			uniforms[u].length = v.b->length;
+		} else {
+			return;
+		}
+	}
+	// The loop picks up wherever the kernel leaves off.
+	size_t done = regs[i.c].i;
+	regs[i.c].i += simd::run(k, uniforms, src.b->data + done,
+			buf.b->data + done, src.b->length - done);
+}
+
+bool machine::map(const value &seq, const value &fn, value *result) {
+	// Mapping over bytes yields bytes until some result does not fit in
+	// one, at which point everything produced so far is widened.
+	size_t length;
+	switch (seq.type) {
+		case kind::blob: length = seq.b->length; break;
+		case kind::array: length = seq.a->length; break;
+		default: return fault("only sequences can be mapped");
+	}
+	blob *bytes = seq.type == kind::blob? memory.make_blob(length): nullptr;
+	array *items = bytes? nullptr: memory.make_array(length);
+	for (size_t i = 0; i < length; ++i) {
+		value arg = seq.type == kind::blob?
+				value(int64_t(seq.b->data[i])): seq.a->items[i];
+		value out;
+		if (!call(fn, &arg, 1, &out)) return false;
+		if (bytes && out.type == kind::integer && out.i >= 0 && out.i < 256) {
+			bytes->data[i] = out.i;
+			continue;
+		}
+		if (bytes) {
+			items = widen(bytes, i);
+			bytes = nullptr;
+		}
+		items->items[i] = out;
+	}
+	*result = bytes? value(bytes): value(items);
+	return true;
+}
+
+bool machine::arithmetic(const instr &i, value *regs) {
+	const value &left = regs[i.b];
+	const value &right = regs[i.c];
+	switch (i.op) {
+		case bytecode::mul:
+			return map(left, right, &regs[i.a]);
+		case bytecode::eq:
+		case bytecode::neq: {
+			bool same = left.type == right.type;
+			if (same && left.type == kind::blob) {
+				same = left.b->length == right.b->length &&
+						!memcmp(left.b->data, right.b->data, left.b->length);
+			} else if (same && left.type != kind::nil) {
+				same = left.i == right.i || left.a == right.a;
+			}
+			regs[i.a] = value(int64_t(-(same == (i.op == bytecode::eq))));
+			return true;
+		}
+		default:
+			return fault(std::string("operands of '") +
+					bytecode::mnemonic(i.op) + "' must be integers");
+	}
+}
+
+bool machine::enter(const closure *c, const value *args, unsigned n) {
+	const bytecode::function &fn = prog.functions[c->function];
+	if (fn.params != n) {
+		return fault("wrong number of arguments to '" + fn.name + "'");
+	}
+	value *regs = stack.data();
+	if (!frames.empty()) {
+		regs = frames.back().regs + frames.back().fn->registers;
+	}
+	if (frames.size() >= max_depth ||
+			regs + fn.registers > stack.data() + stack.size()) {
+		return fault("stack overflow");
+	}
+	for (unsigned i = 0; i < n; ++i) {
+		regs[i] = args[i];
+	}
+	for (unsigned i = n; i < fn.registers; ++i) {
+		regs[i] = value();
+	}
+	frames.push_back(frame{&fn, fn.code.data(), regs, c, heap::mark()});
+	if (fn.regional) {
+		frames.back().region = scratch.save();
+	}
+	return true;
+}
+
+heap &machine::region(const frame &f, const instr *pc) {
+	return f.fn->local[pc - f.fn->code.data()]? scratch: memory;
+}
+
+void machine::unwind(size_t depth) {
+	// The outermost frame being abandoned holds the mark everything the
+	// others allocated came after.
+	for (size_t i = depth; i < frames.size(); ++i) {
+		if (frames[i].fn->regional) {
+			scratch.release(frames[i].region);
+			break;
+		}
+	}
+	frames.resize(depth);
+}
+
+bool machine::fault(std::string message) {
+	location loc;
+	if (!frames.empty()) {
+		const frame &f = frames.back();
+		size_t pc = f.pc - f.fn->code.data();
+		if (pc < f.fn->origins.size()) {
+			loc = f.fn->origins[pc];
+		}
+	}
+	err.report(loc, "runtime error: " + message);
+	return false;
+}
+
+bool machine::execute(size_t depth, value *result) {
+#define LABEL(name) &&op_##name,
+#define LABELI(name) &&op_##name##i,
+	static void *const labels[] = {
+		&&op_nop, &&op_nil, &&op_integer, &&op_load, &&op_move,
+		&&op_getglobal, &&op_setglobal, &&op_upvalue, &&op_closure,
+		&&op_tuple, &&op_range, &&op_length, &&op_element, &&op_buffer,
+		&&op_store, &&op_vector, &&op_neg, &&op_inv,
+		BYTECODE_ARITHMETIC(LABEL)
+		BYTECODE_IMMEDIATE(LABELI)
+		&&op_jump, &&op_jumpif, &&op_jumpnot, &&op_jumptable,
+		&&op_call, &&op_apply, &&op_ret, &&op_fail
+	};
+	// The same table, but with every operation leading through the profiler.
+#define PROBE(name) &&probe,
+	static void *const probes[] = {
+		&&probe, &&probe, &&probe, &&probe, &&probe,
+		&&probe, &&probe, &&probe, &&probe,
+		&&probe, &&probe, &&probe, &&probe, &&probe,
+		&&probe, &&probe, &&probe, &&probe,
+		BYTECODE_ARITHMETIC(PROBE)
+		BYTECODE_IMMEDIATE(PROBE)
+		&&probe, &&probe, &&probe, &&probe,
+		&&probe, &&probe, &&probe, &&probe
+	};
+#undef LABEL
+#undef LABELI
+#undef PROBE
+	// A missing entry would be a null jump target.
+	static_assert(sizeof(labels) / sizeof(*labels) == bytecode::op_count,
+			"every operation needs a label");
+	static_assert(sizeof(probes) / sizeof(*probes) == bytecode::op_count,
+			"every operation needs a probe");
+	void *const *dispatch = profile? probes: labels;
+	frame *f = &frames.back();
+	const instr *code = f->fn->code.data();
+	const instr *pc = f->pc;
+	value *r = f->regs;
+#define DISPATCH() goto *dispatch[pc->op]
+#define NEXT() do { ++pc; DISPATCH(); } while (0)
+#define SAVE() (f->pc = pc)
+#define RESUME() do { \
+		f = &frames.back(); code = f->fn->code.data(); \
+		pc = f->pc; r = f->regs; \
+	} while (0)
+	DISPATCH();
+
+probe:
+	SAVE();
+	profile->step(*this);
+	goto *labels[pc->op];
+op_nop:
+	NEXT();
+op_nil:
+	r[pc->a] = value();
+	NEXT();
+op_integer:
+	r[pc->a] = value(int64_t(int16_t(pc->c)));
+	NEXT();
+op_load:
+	r[pc->a] = constants[pc->b];
+	NEXT();
+op_move:
+	r[pc->a] = r[pc->b];
+	NEXT();
+op_getglobal:
+	if (states[pc->b] != status::ready) {
+		SAVE();
+		if (!initialize(pc->b)) goto fail;
+	}
+	r[pc->a] = globals[pc->b];
+	NEXT();
+op_setglobal:
+	globals[pc->b] = r[pc->a];
+	NEXT();
+op_upvalue:
+	r[pc->a] = f->env->env[pc->b];
+	NEXT();
+op_closure: {
+	if (!pc->n) {
+		r[pc->a] = value(statics[pc->b]);
+		NEXT();
+	}
+	closure *c = region(*f, pc).make_closure(pc->b, pc->n);
+	for (unsigned i = 0; i < pc->n; ++i) {
+		c->env[i] = r[pc->c + i];
+	}
+	r[pc->a] = value(c);
+	NEXT();
+}
+op_tuple: {
+	array *t = region(*f, pc).make_array(pc->n);
+	for (unsigned i = 0; i < pc->n; ++i) {
+		t->items[i] = r[pc->b + i];
+	}
+	r[pc->a] = value(t);
+	NEXT();
+}
+op_range: {
+	SAVE();
+	const value &lo = r[pc->b], &hi = r[pc->c];
+	if (lo.type != kind::integer || hi.type != kind::integer) {
+		fault("range bounds must be integers");
+		goto fail;
+	}
+	size_t length = hi.i > lo.i? uint64_t(hi.i - lo.i): 0;
+	array *t = region(*f, pc).make_array(length);
+	for (size_t i = 0; i < length; ++i) {
+		t->items[i] = value(int64_t(lo.i + i));
+	}
+	r[pc->a] = value(t);
+	NEXT();
+}
+op_length: {
+	const value &seq = r[pc->b];
+	if (seq.type == kind::blob) {
+		r[pc->a] = value(int64_t(seq.b->length));
+	} else if (seq.type == kind::array) {
+		r[pc->a] = value(int64_t(seq.a->length));
+	} else {
+		SAVE();
+		fault("only sequences can be mapped");
+		goto fail;
+	}
+	NEXT();
+}
+op_element: {
+	const value &seq = r[pc->b];
+	int64_t i = r[pc->c].i;
+	r[pc->a] = seq.type == kind::blob?
+			value(int64_t(seq.b->data[i])): seq.a->items[i];
+	NEXT();
+}
+op_buffer: {
+	int64_t length = r[pc->b].type == kind::integer? r[pc->b].i: 0;
+	if (length < 0) length = 0;
+	if (r[pc->c].type == kind::blob) {
+		r[pc->a] = value(region(*f, pc).make_blob(length));
+	} else {
+		r[pc->a] = value(region(*f, pc).make_array(length));
+	}
+	NEXT();
+}
+op_store: {
+	value &buf = r[pc->a];
+	int64_t i = r[pc->b].i;
+	const value &item = r[pc->c];
+	if (buf.type == kind::blob) {
+		if (item.type == kind::integer && uint64_t(item.i) < 256) {
+			buf.b->data[i] = item.i;
+			NEXT();
+		}
+		buf = value(widen(buf.b, i));
+	}
+	buf.a->items[i] = item;
+	NEXT();
+}
+op_vector:
+	if (vectorize) tiles(*pc, r);
+	NEXT();
+op_neg:
+	if (r[pc->b].type != kind::integer) goto not_integer;
+	r[pc->a] = value(int64_t(-uint64_t(r[pc->b].i)));
+	NEXT();
+op_inv:
+	if (r[pc->b].type != kind::integer) goto not_integer;
+	r[pc->a] = value(~r[pc->b].i);
+	NEXT();
+
+	// Integer arithmetic wraps; shift counts are taken modulo 64.
+#define INTEGER_OP(name, expr) \
+op_##name: { \
+	const value &x = r[pc->b], &y = r[pc->c]; \
+	if (x.type == kind::integer && y.type == kind::integer) { \
+		int64_t a = x.i, b = y.i; \
+		r[pc->a] = value(int64_t(expr)); \
+		NEXT(); \
+	} \
+	SAVE(); \
+	if (!arithmetic(*pc, r)) goto fail; \
+	NEXT(); \
+} \
+op_##name##i: { \
+	const value &x = r[pc->b]; \
+	if (x.type == kind::integer) { \
+		int64_t a = x.i, b = int16_t(pc->c); \
+		r[pc->a] = value(int64_t(expr)); \
+		NEXT(); \
+	} \
+	goto not_integer; \
+}
+#define INTEGER_OP_NOIMM(name, expr) \
+op_##name: { \
+	const value &x = r[pc->b], &y = r[pc->c]; \
+	if (x.type == kind::integer && y.type == kind::integer) { \
+		int64_t a = x.i, b = y.i; \
+		r[pc->a] = value(int64_t(expr)); \
+		NEXT(); \
+	} \
+	goto not_integer; \
+}
+#define DIVISION_OP(name, expr, wrap) \
+op_##name: { \
+	const value &x = r[pc->b], &y = r[pc->c]; \
+	if (x.type != kind::integer || y.type != kind::integer) { \
+		goto not_integer; \
+	} \
+	int64_t a = x.i, b = y.i; \
+	if (!b) goto divide_by_zero; \
+	r[pc->a] = value(int64_t(b == -1? (wrap): (expr))); \
+	NEXT(); \
+} \
+op_##name##i: { \
+	const value &x = r[pc->b]; \
+	if (x.type != kind::integer) goto not_integer; \
+	int64_t a = x.i, b = int16_t(pc->c); \
+	if (!b) goto divide_by_zero; \
+	r[pc->a] = value(int64_t(b == -1? (wrap): (expr))); \
+	NEXT(); \
+}
+	INTEGER_OP(add, uint64_t(a) + uint64_t(b))
+	INTEGER_OP(sub, uint64_t(a) - uint64_t(b))
+	INTEGER_OP(mul, uint64_t(a) * uint64_t(b))
+	DIVISION_OP(div, a / b, -uint64_t(a))
+	DIVISION_OP(rem, a % b, 0)
+	INTEGER_OP(shl, uint64_t(a) << (b & 63))
+	INTEGER_OP(shr, a >> (b & 63))
+	INTEGER_OP(band, a & b)
+	INTEGER_OP_NOIMM(bor, a | b)
+	INTEGER_OP_NOIMM(bxor, a ^ b)
+	INTEGER_OP_NOIMM(bnand, ~(a & b))
+	INTEGER_OP_NOIMM(bnor, ~(a | b))
+	INTEGER_OP_NOIMM(bxnor, ~(a ^ b))
+	INTEGER_OP(eq, -(a == b))
+	INTEGER_OP(gt, -(a > b))
+	INTEGER_OP(lt, -(a < b))
+	INTEGER_OP(neq, -(a != b))
+	INTEGER_OP(ngt, -(a <= b))
+	INTEGER_OP(nlt, -(a >= b))
+#undef INTEGER_OP
+#undef INTEGER_OP_NOIMM
+#undef DIVISION_OP
+
+op_jump:
+	if (pc->a && f->fn->regional) {
+		// Nothing the pass which is ending put in the region survives it.
+		scratch.release(f->region);
+	}
+	pc = code + pc->b;
+	DISPATCH();
+op_jumpif:
+	if (r[pc->a].type != kind::integer) goto not_integer;
+	if (r[pc->a].i) {
+		pc = code + pc->b;
+		DISPATCH();
+	}
+	NEXT();
+op_jumpnot:
+	if (r[pc->a].type != kind::integer) goto not_integer;
+	if (!r[pc->a].i) {
+		pc = code + pc->b;
+		DISPATCH();
+	}
+	NEXT();
+op_jumptable: {
+	const bytecode::table &t = f->fn->tables[pc->b];
+	const value &v = r[pc->a];
+	uint64_t k = uint64_t(v.i) - uint64_t(t.low);
+	bool hit = v.type == kind::integer && k < t.targets.size();
+	pc = code + (hit? t.targets[k]: t.otherwise);
+	DISPATCH();
+}
+op_call:
+	SAVE();
+	if (!enter(statics[pc->b], r + pc->c, pc->n)) goto fail;
+	RESUME();
+	DISPATCH();
+op_apply: {
+	const value &fn = r[pc->b];
+	if (fn.type == kind::blob && pc->n == 1) {
+		// Byte table lookups are common enough to skip the general path.
+		const value &index = r[pc->c];
+		if (index.type == kind::integer && uint64_t(index.i) < fn.b->length) {
+			r[pc->a] = value(int64_t(fn.b->data[index.i]));
+			NEXT();
+		}
+	}
+	SAVE();
+	if (fn.type == kind::closure) {
+		if (!enter(fn.c, r + pc->c, pc->n)) goto fail;
+		RESUME();
+		DISPATCH();
+	}
+	value out;
+	if (!call(fn, r + pc->c, pc->n, &out)) goto fail;
+	r[pc->a] = out;
+	NEXT();
+}
+op_ret: {
+	value out = r[pc->a];
+	if (f->fn->regional) {
+		scratch.release(f->region);
+	}
+	frames.pop_back();
+	if (frames.size() == depth) {
+		if (profile) {
+			// Another call may take this frame's place before the next step.
+			profile->step(*this);
+		}
+		*result = out;
+		return true;
+	}
+	RESUME();
+	r[pc->a] = out;
+	NEXT();
+}
+
+op_fail:
+	SAVE();
+	fault("no clause of '" + prog.functions[pc->b].name +
+			"' matches the arguments");
+	goto fail;
+not_integer:
+	SAVE();
+	fault(std::string("operands of '") +
+			bytecode::mnemonic(pc->op) + "' must be integers");
+	goto fail;
+divide_by_zero:
+	SAVE();
+	fault("division by zero");
+	goto fail;
+fail:
+	unwind(depth);
+	if (profile) {
+		profile->step(*this);
+	}
+	return false;
+#undef DISPATCH
+#undef NEXT
+#undef SAVE
+#undef RESUME
+}
+
+void vm::write(std::ostream &out, const bytecode::program &p, const value &v) {
+	switch (v.type) {
+		case kind::nil: break;
+		case kind::integer: out << v.i; break;
+		case kind::blob:
+			out.write(reinterpret_cast<const char*>(v.b->data), v.b->length);
+			break;
+		case kind::array:
+			out << "(";
+			for (size_t i = 0; i < v.a->length; ++i) {
+				if (i) out << ", ";
+				write(out, p, v.a->items[i]);
+			}
+			out << ")";
+			break;
+		case kind::closure:
+			out << "<" << p.functions[v.c->function].name << ">";
+			break;
+	}
+}
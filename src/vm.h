@@ -0,0 +1,152 @@
+// Copyright (C) 2016 Mars Saxman. All rights reserved.
+// Permission is granted to use at your own risk and distribute this software
+// in source and binary forms provided all source code distributions retain
+// this paragraph and the above copyright notice. THIS SOFTWARE IS PROVIDED "AS
+// IS" WITH NO EXPRESS OR IMPLIED WARRANTY.
+
+#ifndef VM_H
+#define VM_H
+
+#include "bytecode.h"
+#include "errors.h"
+#include "simd.h"
+#include <ostream>
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+struct blob;
+struct array;
+struct closure;
+class profiler;
+
+enum class kind: uint8_t { nil, integer, blob, array, closure };
+
+// Registers hold integers unboxed; everything else lives on the heap.
+struct value {
+	value(): type(kind::nil), i(0) {}
+	explicit value(int64_t v): type(kind::integer), i(v) {}
+	explicit value(blob *v): type(kind::blob), b(v) {}
+	explicit value(array *v): type(kind::array), a(v) {}
+	explicit value(closure *v): type(kind::closure), c(v) {}
+	kind type;
+	union {
+		int64_t i;
+		blob *b;
+		array *a;
+		closure *c;
+	};
+};
+
+struct blob {
+	size_t length;
+	uint8_t data[1];
+};
+
+struct array {
+	size_t length;
+	value items[1];
+};
+
+struct closure {
+	unsigned function;
+	unsigned count;
+	value env[1];
+};
+
+// Bump allocator, with no collector: everything it hands out is released
+// together, either when the heap is destroyed or, for everything allocated
+// since a mark, when the heap is rolled back to that mark. Marks nest, so a
+// heap can serve as a stack of regions.
+class heap {
+public:
+	heap() {}
+	heap(const heap&) = delete;
+	~heap();
+	void *allocate(size_t);
+	blob *make_blob(size_t length);
+	array *make_array(size_t length);
+	closure *make_closure(unsigned function, unsigned count);
+	struct mark {
+		size_t chunks;
+		char *next;
+		char *limit;
+	};
+	mark save() const { return mark{chunks.size(), next, limit}; }
+	void release(const mark&);
+private:
+	struct chunk {
+		char *base;
+		size_t size;
+	};
+	std::vector<chunk> chunks;
+	std::vector<char*> spare; // released chunks of the standard size
+	char *next = nullptr;
+	char *limit = nullptr;
+};
+
+// Executes register bytecode. Dispatch is threaded through a table of label
+// addresses, so each handler jumps directly to the next; this relies on the
+// GNU labels-as-values extension.
+class machine {
+public:
+	machine(const bytecode::program&, errors&);
+	// Runs the top-level statements, yielding the last one's value.
+	bool start(value *result);
+	// Applies any applicable value to arguments, as the 'apply' op does.
+	bool call(const value &fn, const value *args, unsigned n, value *result);
+	bool global(const std::string &name, value *out);
+	// The machine's own region, which lasts as long as it does. Values which
+	// escape analysis shows never outlive their call go in 'scratch' instead,
+	// which each such call rolls back when it returns.
+	heap memory;
+	heap scratch;
+	// Maps over byte arrays use vector kernels where they can.
+	bool vectorize = true;
+	// Shown every instruction before it runs, if there is one.
+	profiler *profile = nullptr;
+private:
+	friend class profiler;
+	struct frame {
+		const bytecode::function *fn;
+		const bytecode::instr *pc;
+		value *regs;
+		const closure *env;
+		heap::mark region; // if the function allocates locally
+	};
+	heap &region(const frame&, const bytecode::instr*);
+	bool enter(const closure*, const value *args, unsigned n);
+	void unwind(size_t depth);
+	bool execute(size_t depth, value *result);
+	bool arithmetic(const bytecode::instr&, value *regs);
+	bool map(const value &seq, const value &fn, value *result);
+	// Converts the first 'count' bytes of a byte buffer to a value array.
+	array *widen(const blob*, size_t count);
+	// Runs the kernel for the loop following a 'vector' instruction.
+	void tiles(const bytecode::instr&, value *regs);
+	bool initialize(unsigned global);
+	bool fault(std::string message);
+	const bytecode::program &prog;
+	errors &err;
+	std::vector<value> constants;
+	std::vector<value> globals;
+	enum class status: uint8_t { ready, pending, busy };
+	std::vector<status> states;
+	std::vector<closure*> statics;
+	std::unordered_map<const bytecode::instr*, simd::kernel> kernels;
+	std::vector<frame> frames;
+	std::vector<value> stack;
+	static const size_t max_depth = 1 << 16;
+	static const size_t stack_size = 1 << 20;
+};
+
+// Writes a value as program output: byte arrays verbatim, numbers in
+// decimal, and arrays as parenthesized lists.
+void write(std::ostream&, const bytecode::program&, const value&);
+
+} // namespace vm
+
+#endif //VM_H